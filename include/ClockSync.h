@@ -0,0 +1,109 @@
+// Client clock synchronization to the server, NTP style.
+
+// Each keepalive round trip gives four times: t1 client send, t2 server
+// receive, t3 server send, t4 client receive (all millis on their own board).
+// From those, offset = ((t2 - t1) + (t3 - t4)) / 2 is the server clock minus
+// the client clock, good to within half the round trip asymmetry. Like the
+// NTP clock filter, the sample with the shortest round trip in the window is
+// trusted for the offset, and the drift between the two crystals is the least
+// squares slope of the offsets over the window.
+
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+const int syncWindow = 8;                 // Round trips kept
+const double syncMaxDrift = 0.0005;       // 500 ppm, anything more is noise
+const long syncStepLimit = 1000;          // An offset step bigger than this means a reboot, start over
+
+class ClockSync {
+public:
+  ClockSync() { reset(); }
+
+  void reset() {
+    count = 0;
+    next = 0;
+    refTime = 0;
+    refOffset = 0;
+    bestDelay = 0;
+    drift = 0;
+  }
+
+  // Add one keepalive round trip.
+  void addSample(uint32_t t1, uint32_t t2, uint32_t t3, uint32_t t4) {
+    long delay = (int32_t) (t4 - t1) - (int32_t) (t3 - t2);
+    if (delay < 0) { delay = 0; }
+    long offset = ((int32_t) (t2 - t1) + (int32_t) (t3 - t4)) / 2;
+    if (count && labs(offset - refOffset) > syncStepLimit) { reset(); }
+
+    samples[next].at = t4;
+    samples[next].offset = offset;
+    samples[next].delay = delay;
+    next = (next + 1) % syncWindow;
+    if (count < syncWindow) { count++; }
+    update();
+  }
+
+  bool synced() const { return count > 0; }
+
+  // Server time for a time on the client clock.
+  uint32_t toServer(uint32_t clientTime) const {
+    long elapsed = (int32_t) (clientTime - refTime);
+    return clientTime + refOffset + (long) (drift * elapsed);
+  }
+
+  long offset() const { return refOffset; }
+  long roundTrip() const { return bestDelay; }
+  double driftPpm() const { return drift * 1e6; }
+
+private:
+  struct Sample {
+    uint32_t at;                          // client receive time
+    long offset;
+    long delay;
+  };
+
+  void update() {
+    int best = 0;
+    for (int i = 1; i < count; i++) {
+      if (samples[i].delay < samples[best].delay) { best = i; }
+    }
+    refTime = samples[best].at;
+    refOffset = samples[best].offset;
+    bestDelay = samples[best].delay;
+
+    if (count < 3) { return; }
+
+    double meanT = 0, meanO = 0;
+    for (int i = 0; i < count; i++) {
+      meanT += (int32_t) (samples[i].at - refTime);
+      meanO += samples[i].offset;
+    }
+    meanT /= count;
+    meanO /= count;
+
+    double cov = 0, var = 0;
+    for (int i = 0; i < count; i++) {
+      double t = (int32_t) (samples[i].at - refTime) - meanT;
+      cov += t * (samples[i].offset - meanO);
+      var += t * t;
+    }
+    if (var <= 0) { return; }
+
+    drift = cov / var;
+    if (drift > syncMaxDrift) { drift = syncMaxDrift; }
+    if (drift < -syncMaxDrift) { drift = -syncMaxDrift; }
+  }
+
+  Sample samples[syncWindow];
+  int count;
+  int next;
+  uint32_t refTime;
+  long refOffset;
+  long bestDelay;
+  double drift;
+};
+
+#endif
@@ -0,0 +1,65 @@
+// Queue of datagrams waiting to be sent.
+
+// A fixed ring of datagram buffers: a datagram is copied in once, when it is
+// made, and sent from where it lies when loop() gets to it, so whoever makes
+// one never waits on the network. When the ring is full, the oldest datagram
+// is dropped to make room, on the grounds that the newest is the one that
+// matters (a run frame carries copies of the ones before it anyway).
+
+#ifndef DATAGRAMQUEUE_H
+#define DATAGRAMQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <WireFormat.h>
+
+template <int slots>
+class DatagramQueue {
+public:
+  DatagramQueue() : drops(0), head(0), count(0) {}
+
+  // Add a datagram. Returns false if it is too big to queue.
+  bool push(const uint8_t *data, size_t size) {
+    if (size > wireMaxDatagram) { return false; }
+    if (count == slots) {
+      shift();
+      drops++;
+    }
+    Slot &slot = ring[(head + count) % slots];
+    slot.size = size;
+    memcpy(slot.bytes, data, size);
+    count++;
+    return true;
+  }
+
+  // The oldest datagram. Only valid while the queue is not empty.
+  const uint8_t *first(size_t &size) const {
+    size = ring[head].size;
+    return ring[head].bytes;
+  }
+
+  void shift() {
+    if (!count) { return; }
+    head = (head + 1) % slots;
+    count--;
+  }
+
+  bool isEmpty() const { return count == 0; }
+  bool isFull() const { return count == slots; }
+  int size() const { return count; }
+
+  unsigned long drops;                    // datagrams dropped to make room
+
+private:
+  struct Slot {
+    uint16_t size;
+    uint8_t bytes[wireMaxDatagram];
+  };
+
+  Slot ring[slots];
+  int head;
+  int count;
+};
+
+#endif
@@ -0,0 +1,92 @@
+// Integrator debounce for a contact, on timestamped edges.
+
+// The classic integrator counts samples up while the contact reads closed
+// and down while it reads open, and only changes its output on reaching
+// either end. Here the "samples" are the time between edges, in
+// microseconds: while the raw level is closed the integrator rises at one
+// per microsecond, while open it falls, and it is clamped to 0..fullScale.
+// Contact bounce moves it back and forth in the middle without changing the
+// output, and a clean edge changes the output fullScale microseconds later.
+// The time of a change is taken as the raw edge that started the settled
+// run, so timing is exact to the edge and not delayed by the debounce.
+//
+// A press also sets a latch that stays set until taken, so a tap shorter
+// than a pass of loop() is not missed.
+
+#ifndef DEBOUNCER_H
+#define DEBOUNCER_H
+
+#include <stdint.h>
+
+class Debouncer {
+public:
+  Debouncer(uint32_t fullScale) : fullScale(fullScale) { reset(false, 0); }
+
+  void reset(bool closed, uint32_t now) {
+    raw = closed;
+    out = closed;
+    level = closed ? fullScale : 0;
+    last = now;
+    runStart = now;
+    changed = now;
+    latched = false;
+  }
+
+  // The raw contact changed at a time.
+  void edge(bool closed, uint32_t at) {
+    settle(at);
+    if (closed != raw) {
+      raw = closed;
+      runStart = at;
+    }
+  }
+
+  // Integrate up to a time. Call before reading the output.
+  void settle(uint32_t now) {
+    int32_t dt = (int32_t) (now - last);
+    if (dt <= 0) { return; }
+    last = now;
+
+    if (raw) {
+      level = (uint32_t) dt >= fullScale - level ? fullScale : level + dt;
+      if (level == fullScale && !out) {
+        out = true;
+        latched = true;
+        changed = runStart;
+      }
+    } else {
+      level = (uint32_t) dt >= level ? 0 : level - dt;
+      if (level == 0 && out) {
+        out = false;
+        changed = runStart;
+      }
+    }
+  }
+
+  bool closed() const { return out; }
+
+  // Time of the last output change, in micros.
+  uint32_t changedAt() const { return changed; }
+
+  // Whether there was a press since the last takePress(), without taking it.
+  bool pressSeen() const { return latched; }
+
+  // Whether there was a press since the last time this was called.
+  bool takePress() {
+    bool was = latched;
+    latched = false;
+    return was;
+  }
+
+private:
+  uint32_t fullScale;
+  bool raw;                               // contact as last seen
+  bool out;                               // debounced
+  uint32_t level;                         // integrator, 0..fullScale
+  uint32_t last;                          // integrated up to, in micros
+  uint32_t runStart;                      // when raw last changed
+  uint32_t changed;
+  bool latched;
+};
+
+#endif
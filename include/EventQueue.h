@@ -0,0 +1,71 @@
+// Lock-free single producer, single consumer queue.
+
+// Made for passing events from an interrupt handler to loop(): the handler
+// only ever moves head, and loop() only ever moves tail, so neither needs to
+// turn interrupts off. One slot is kept empty to tell full from empty, and
+// size must be a power of two. When the queue is full, new events are
+// dropped and counted, so the consumer knows to resynchronize.
+//
+// The paddle and timer1 interrupt handlers call push(), pop() and peek(), so
+// those are always inlined into them: a call out of IRAM into a template
+// instance in flash would fault while the flash cache is off.
+
+#ifndef EVENTQUEUE_H
+#define EVENTQUEUE_H
+
+#include <stdint.h>
+
+template <typename T, int size>
+class EventQueue {
+public:
+  EventQueue() : head(0), tail(0), dropped(0) {}
+
+  // Producer side. Returns false, and counts a drop, when the queue is full.
+  inline __attribute__((always_inline)) bool push(const T &event) {
+    uint8_t h = head;
+    uint8_t next = (h + 1) & (size - 1);
+    if (next == tail) {
+      dropped++;
+      return false;
+    }
+    slots[h] = event;
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    head = next;
+    return true;
+  }
+
+  // Consumer side. Returns false when the queue is empty.
+  inline __attribute__((always_inline)) bool pop(T &event) {
+    uint8_t t = tail;
+    if (t == head) { return false; }
+    __atomic_signal_fence(__ATOMIC_ACQUIRE);
+    event = slots[t];
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    tail = (t + 1) & (size - 1);
+    return true;
+  }
+
+  // Consumer side. Look at the oldest event without taking it.
+  inline __attribute__((always_inline)) bool peek(T &event) const {
+    uint8_t t = tail;
+    if (t == head) { return false; }
+    __atomic_signal_fence(__ATOMIC_ACQUIRE);
+    event = slots[t];
+    return true;
+  }
+
+  bool isEmpty() const { return head == tail; }
+
+  // Events lost to a full queue, ever. Only the producer writes it.
+  uint32_t drops() const { return dropped; }
+
+private:
+  static_assert(size >= 2 && size <= 256 && (size & (size - 1)) == 0, "size must be a power of two up to 256");
+
+  T slots[size];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+  volatile uint32_t dropped;
+};
+
+#endif
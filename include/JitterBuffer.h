@@ -0,0 +1,93 @@
+// Adaptive playout delay for the server.
+
+// Keeps a window of recent transit samples (arrival time minus the sender's
+// time for the frame, so it includes the unknown offset between the two
+// clocks) and sizes the playout offset so that a target percentile of frames
+// arrive before they are due. On a clean LAN the window is tight and the delay
+// shrinks; on a lossy WiFi hop the tail grows, and the delay with it.
+// Also keeps the RFC 3550 interarrival jitter estimate for reporting.
+
+#ifndef JITTERBUFFER_H
+#define JITTERBUFFER_H
+
+const int jitterWindow = 64;              // Transit samples kept
+const int jitterMinSamples = 8;           // Below this, hold at least the initial delay
+
+class JitterBuffer {
+public:
+  JitterBuffer(int percentile, long minDelay, long maxDelay, long initialDelay)
+    : percentile(percentile), minDelay(minDelay), maxDelay(maxDelay), initialDelay(initialDelay) {
+    reset();
+  }
+
+  void reset() {
+    count = 0;
+    next = 0;
+    last = 0;
+    jitter16 = 0;
+    fast = 0;
+    playout = initialDelay;
+  }
+
+  // Record the transit of a frame, in millis.
+  void addTransit(long transit) {
+    if (count) {
+      long d = transit - last;
+      if (d < 0) { d = -d; }
+      jitter16 += d - (jitter16 >> 4);
+    }
+    last = transit;
+    samples[next] = transit;
+    next = (next + 1) % jitterWindow;
+    if (count < jitterWindow) { count++; }
+    update();
+  }
+
+  // Local time minus sender time at which frames should be played.
+  long offset() const { return fast + playout; }
+
+  // Playout delay over the fastest transit in the window.
+  long delay() const { return playout; }
+
+  long fastest() const { return fast; }
+  long lastTransit() const { return last; }
+  long jitter() const { return jitter16 >> 4; }
+  int samplesHeld() const { return count; }
+
+private:
+  void update() {
+    long sorted[jitterWindow];
+    int n = count;
+
+    for (int i = 0; i < n; i++) {
+      long v = samples[i];
+      int j = i;
+      while (j > 0 && sorted[j - 1] > v) {
+        sorted[j] = sorted[j - 1];
+        j--;
+      }
+      sorted[j] = v;
+    }
+
+    fast = sorted[0];
+    playout = sorted[(n - 1) * percentile / 100] - fast;
+    if (n < jitterMinSamples && playout < initialDelay) { playout = initialDelay; }
+    if (playout < minDelay) { playout = minDelay; }
+    if (playout > maxDelay) { playout = maxDelay; }
+  }
+
+  int percentile;
+  long minDelay;
+  long maxDelay;
+  long initialDelay;
+
+  long samples[jitterWindow];
+  int count;
+  int next;
+  long last;
+  long jitter16;                          // Interarrival jitter, scaled by 16
+  long fast;
+  long playout;
+};
+
+#endif
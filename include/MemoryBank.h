@@ -0,0 +1,162 @@
+// Keyer memories, kept as files on LittleFS.
+
+// Each slot is a file, /mem/<slot>, holding the recorded codes one byte
+// each (0 dit, 1 dah, 5 and up a space). An index file, /mem/index, keeps
+// the length of every slot, so nothing has to be opened to know what is
+// there. A recording goes to a temporary file that is renamed over the slot
+// only when it is finished, and the index is replaced the same way; a rename
+// on LittleFS replaces its target in one step, so a power loss at any point
+// keeps either the old message or the new one.
+//
+// Playback streams the slot through two chunk buffers: one is played from
+// while the other is refilled, by fill(), at a moment the caller chooses
+// (while an element is keying), so a flash read never holds up the next
+// element. RAM use is the same for any number or length of messages.
+
+#ifndef MEMORYBANK_H
+#define MEMORYBANK_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <LittleFS.h>
+
+const int memoryBankSlots = 30;           // Ten pages of three, one slot a memory button
+const size_t memoryChunk = 32;            // Bytes read or written at a time
+const size_t memoryMaxSize = 4096;        // Longest message
+
+class MemoryBank {
+public:
+  MemoryBank() : recordSlot(-1), playing(false) {}
+
+  // Mount the filesystem, formatting it the first time, and read the index.
+  bool begin() {
+    if (!LittleFS.begin()) {
+      if (!LittleFS.format() || !LittleFS.begin()) { return false; }
+    }
+    memset(sizes, 0, sizeof(sizes));
+    File index = LittleFS.open("/mem/index", "r");
+    if (index) {
+      index.read((uint8_t *) sizes, sizeof(sizes));
+      index.close();
+    }
+    return true;
+  }
+
+  size_t size(int slot) const { return (slot >= 0 && slot < memoryBankSlots) ? sizes[slot] : 0; }
+
+  // Recording.
+
+  bool startRecord(int slot) {
+    if (slot < 0 || slot >= memoryBankSlots) { return false; }
+    file = LittleFS.open("/mem/new", "w");
+    if (!file) { return false; }
+    recordSlot = slot;
+    recorded = 0;
+    used[0] = 0;
+    return true;
+  }
+
+  // Add a code to the recording. Returns false when the message is full.
+  bool record(uint8_t value) {
+    if (recordSlot < 0 || recorded >= memoryMaxSize) { return false; }
+    buffer[0][used[0]++] = value;
+    recorded++;
+    if (used[0] == memoryChunk) { flushRecord(); }
+    return true;
+  }
+
+  bool full() const { return recorded >= memoryMaxSize; }
+
+  void endRecord() {
+    if (recordSlot < 0) { return; }
+    flushRecord();
+    file.close();
+    char path[12];
+    slotPath(path, recordSlot);
+    if (recorded) { LittleFS.rename("/mem/new", path); }
+    else {
+      LittleFS.remove("/mem/new");
+      LittleFS.remove(path);
+    }
+    sizes[recordSlot] = recorded;
+    recordSlot = -1;
+    writeIndex();
+  }
+
+  // Playback.
+
+  bool startPlay(int slot) {
+    stopPlay();
+    if (!size(slot)) { return false; }
+    char path[12];
+    slotPath(path, slot);
+    file = LittleFS.open(path, "r");
+    if (!file) { return false; }
+    playing = true;
+    half = 0;
+    pos = 0;
+    used[0] = used[1] = 0;
+    loaded[0] = loaded[1] = false;
+    fill();
+    return true;
+  }
+
+  // The next code, or -1 at the end of the message.
+  int next() {
+    if (!playing) { return -1; }
+    if (pos == used[half]) {
+      loaded[half] = false;
+      half ^= 1;
+      pos = 0;
+      if (!loaded[half]) { fill(); }
+      if (!used[half]) { return -1; }
+    }
+    return buffer[half][pos++];
+  }
+
+  // Refill whichever buffer has been played out.
+  void fill() {
+    if (!playing) { return; }
+    for (int i = 0; i < 2; i++) {
+      int b = (half + i) & 1;
+      if (loaded[b]) { continue; }
+      used[b] = file.read(buffer[b], memoryChunk);
+      loaded[b] = true;
+    }
+  }
+
+  void stopPlay() {
+    if (!playing) { return; }
+    file.close();
+    playing = false;
+  }
+
+private:
+  static void slotPath(char *path, int slot) { snprintf(path, 12, "/mem/%d", slot); }
+
+  void flushRecord() {
+    if (used[0]) { file.write(buffer[0], used[0]); }
+    used[0] = 0;
+  }
+
+  void writeIndex() {
+    File index = LittleFS.open("/mem/index.new", "w");
+    if (!index) { return; }
+    index.write((const uint8_t *) sizes, sizeof(sizes));
+    index.close();
+    LittleFS.rename("/mem/index.new", "/mem/index");
+  }
+
+  File file;
+  uint16_t sizes[memoryBankSlots];
+  int recordSlot;
+  size_t recorded;
+  bool playing;
+  int half;                               // buffer being played
+  size_t pos;
+  uint8_t buffer[2][memoryChunk];
+  size_t used[2];                         // bytes in each buffer
+  bool loaded[2];                         // buffer holds data not yet played
+};
+
+#endif
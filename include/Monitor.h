@@ -0,0 +1,95 @@
+// Monitor fan-out.
+
+// The server passes every run, edge and text datagram it receives on to its
+// monitor listeners, so more than one operator can hear the sending. Each
+// datagram is copied once, into the queue here, and is sent from there to
+// each listener in turn, one send at a time, from loop() after the keying
+// work, so however many listeners there are, the key line never waits for
+// them. If the sends fall behind, the oldest datagram waiting is dropped.
+// A listener is a multicast group, kept for good, or a keyer or program
+// that subscribed, kept until it has not been heard from for a while.
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+#include <string.h>
+#include <ESP8266WiFi.h>
+#include <DatagramQueue.h>
+
+const int monitorMaxListeners = 8;
+const int monitorQueueSize = 8;           // Datagrams waiting to go out
+
+struct MonitorListener {
+  IPAddress ip;
+  uint16_t port;
+  uint8_t group;                          // a multicast group, never let go
+  unsigned long heardAt;                  // millis of the last subscribe
+};
+
+
+class Monitor {
+public:
+  Monitor() : count(0), target(0) {}
+
+  // Add a listener, or note that it is still there. Returns false when the list is full.
+  bool subscribe(const IPAddress &ip, uint16_t port, unsigned long now, bool group = false) {
+    for (int i = 0; i < count; i++) {
+      if ((uint32_t) listeners[i].ip == (uint32_t) ip && listeners[i].port == port) {
+        listeners[i].heardAt = now;
+        return true;
+      }
+    }
+    if (count >= monitorMaxListeners) { return false; }
+    listeners[count].ip = ip;
+    listeners[count].port = port;
+    listeners[count].group = group;
+    listeners[count].heardAt = now;
+    count++;
+    return true;
+  }
+
+  // Let go of the subscribers not heard from for timeout millis. Waits until nothing is
+  // being sent, so no listener misses a datagram or gets one twice.
+  void expire(unsigned long now, unsigned long timeout) {
+    if (!pending.isEmpty()) { return; }
+    for (int i = 0; i < count; ) {
+      if (!listeners[i].group && now - listeners[i].heardAt > timeout) { listeners[i] = listeners[--count]; }
+      else { i++; }
+    }
+  }
+
+  // Queue a datagram for the listeners, if there are any.
+  void queue(const uint8_t *data, size_t size) {
+    if (!count) { return; }
+    if (pending.isFull()) { target = 0; }
+    pending.push(data, size);
+  }
+
+  // The datagram to send next, and the listener it goes to. Returns false when there is
+  // nothing to send.
+  bool next(const uint8_t *&data, size_t &size, const MonitorListener *&to) const {
+    if (pending.isEmpty()) { return false; }
+    data = pending.first(size);
+    to = &listeners[target];
+    return true;
+  }
+
+  // The datagram from next() has been sent to its listener.
+  void sent() {
+    if (++target < count) { return; }
+    pending.shift();
+    target = 0;
+  }
+
+  int listening() const { return count; }
+  unsigned long drops() const { return pending.drops; }  // datagrams not every listener had
+
+private:
+  MonitorListener listeners[monitorMaxListeners];
+  int count;
+  DatagramQueue < monitorQueueSize> pending;
+  int target;                             // listener the head datagram goes to next
+};
+
+#endif
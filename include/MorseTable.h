@@ -0,0 +1,131 @@
+// Morse code table, built at compile time.
+
+// Each character is written out as dits and dahs in morseCodes below, and
+// the table is expanded from that by the compiler: for every ASCII code, the
+// elements packed one bit each (1 = dah, first element in the MSB of the
+// used bits), the element count, and the length of the character in dit
+// units, marks and the spaces between them (not the space after).
+// Nothing is decoded at run time, and characters can be up to 16 elements.
+//
+// The set is ITU-R M.1677-1: letters, figures, é, and . , : ? ' - / ( ) " = + @,
+// plus the common ! $ & ; _ from the ARRL list. Lower case is the same as upper.
+// Prosigns are sent by writing their letters between < and >, so "<SK>" is
+// ...-.- as one character; the common ones also have an escape of their own
+// below, so they can be stored in a single byte.
+
+#ifndef MORSETABLE_H
+#define MORSETABLE_H
+
+#include <stdint.h>
+
+const int morseMaxElements = 16;
+
+// Prosign escapes, control codes that key as the prosign.
+const char morseAR = 0x01;                // .-.-.  end of message
+const char morseAS = 0x02;                // .-...  wait
+const char morseBT = 0x03;                // -...-  break
+const char morseKA = 0x04;                // -.-.-  starting signal
+const char morseKN = 0x05;                // -.--.  go ahead, named station only
+const char morseSK = 0x06;                // ...-.- end of work
+const char morseSN = 0x07;                // ...-.  understood
+const char morseHH = 0x08;                // ........ error
+
+struct MorseCode {
+  uint16_t bits;                          // elements, 1 = dah, last one in bit 0
+  uint8_t length;                         // elements, 0 if there is no code
+  uint8_t units;                          // dit units from first mark to last mark end
+};
+
+struct MorseSource {
+  char ascii;
+  const char *elements;
+};
+
+constexpr MorseSource morseCodes[] = {
+  { 'A', ".-" },      { 'B', "-..." },    { 'C', "-.-." },    { 'D', "-.." },
+  { 'E', "." },       { 'F', "..-." },    { 'G', "--." },     { 'H', "...." },
+  { 'I', ".." },      { 'J', ".---" },    { 'K', "-.-" },     { 'L', ".-.." },
+  { 'M', "--" },      { 'N', "-." },      { 'O', "---" },     { 'P', ".--." },
+  { 'Q', "--.-" },    { 'R', ".-." },     { 'S', "..." },     { 'T', "-" },
+  { 'U', "..-" },     { 'V', "...-" },    { 'W', ".--" },     { 'X', "-..-" },
+  { 'Y', "-.--" },    { 'Z', "--.." },
+  { '0', "-----" },   { '1', ".----" },   { '2', "..---" },   { '3', "...--" },
+  { '4', "....-" },   { '5', "....." },   { '6', "-...." },   { '7', "--..." },
+  { '8', "---.." },   { '9', "----." },
+  { '.', ".-.-.-" },  { ',', "--..--" },  { ':', "---..." },  { '?', "..--.." },
+  { '\'', ".----." }, { '-', "-....-" },  { '/', "-..-." },   { '(', "-.--." },
+  { ')', "-.--.-" },  { '"', ".-..-." },  { '=', "-...-" },   { '+', ".-.-." },
+  { '@', ".--.-." },  { '!', "-.-.--" },  { '$', "...-..-" }, { '&', ".-..." },
+  { ';', "-.-.-." },  { '_', "..--.-" },
+  { morseAR, ".-.-." },  { morseAS, ".-..." },  { morseBT, "-...-" },  { morseKA, "-.-.-" },
+  { morseKN, "-.--." },  { morseSK, "...-.-" }, { morseSN, "...-." },  { morseHH, "........" },
+};
+
+// é has no ASCII code, it is keyed from its Latin-1 one.
+const unsigned char morseEAcute = 0xE9;
+
+
+constexpr MorseCode morseEncode(const char *elements) {
+  MorseCode code = { 0, 0, 0 };
+  for (int i = 0; elements[i] && i < morseMaxElements; i++) {
+    code.bits = (code.bits << 1) | (elements[i] == '-' ? 1 : 0);
+    code.units += (code.length ? 1 : 0) + (elements[i] == '-' ? 3 : 1);
+    code.length++;
+  }
+  return code;
+}
+
+
+struct MorseTable {
+  MorseCode ascii[128];
+  MorseCode eAcute;
+
+  constexpr MorseTable() : ascii(), eAcute(morseEncode("..-..")) {
+    for (MorseCode &code : ascii) { code = MorseCode { 0, 0, 0 }; }   // GCC wants each one set
+    for (const MorseSource &source : morseCodes) {
+      ascii[(int) source.ascii] = morseEncode(source.elements);
+      if (source.ascii >= 'A' && source.ascii <= 'Z') {
+        ascii[source.ascii - 'A' + 'a'] = ascii[(int) source.ascii];
+      }
+    }
+  }
+
+  // The code for a character. One with no code has length 0.
+  constexpr const MorseCode &operator[](char c) const {
+    return (unsigned char) c < 128 ? ascii[(int) c]
+      : (unsigned char) c == morseEAcute || (unsigned char) c == morseEAcute - 0x20 ? eAcute : ascii[0];
+  }
+};
+
+constexpr MorseTable morseTable;
+
+
+// Element i of a code: 1 for a dah, 0 for a dit.
+inline int morseElementAt(const MorseCode &code, int i) {
+  return (code.bits >> (code.length - 1 - i)) & 1;
+}
+
+// The character a code is, or 0 if none. Upper case and punctuation are taken ahead
+// of the prosign escapes, so .-.-. is '+', not morseAR.
+inline char morseDecode(const MorseCode &code) {
+  if (!code.length) { return 0; }
+  for (int c = ' '; c < 128; c++) {
+    if (morseTable.ascii[c].length == code.length && morseTable.ascii[c].bits == code.bits) { return c; }
+  }
+  for (int c = 1; c < ' '; c++) {
+    if (morseTable.ascii[c].length == code.length && morseTable.ascii[c].bits == code.bits) { return c; }
+  }
+  return 0;
+}
+
+// Two characters run together, as for a prosign.
+inline MorseCode morseMerge(const MorseCode &first, const MorseCode &second) {
+  if (first.length + second.length > morseMaxElements) { return first; }
+  MorseCode code;
+  code.bits = (first.bits << second.length) | second.bits;
+  code.length = first.length + second.length;
+  code.units = first.units + second.units + (first.length && second.length ? 1 : 0);
+  return code;
+}
+
+#endif
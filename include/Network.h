@@ -8,3 +8,78 @@ const char* password =  "";
 const char * host = "";
 
 const unsigned int port = 4120;
+
+// Send each element as it is keyed, rather than whole characters. Much lower latency,
+// but needs a steady link. The server handles both.
+const int streamElements = 1;
+
+// Server playout delay, in millis. The server measures the jitter on the link and delays
+// keying so that jitterPercentile percent of frames arrive in time, within the limits below.
+// playoutDelay is held until there are enough measurements.
+const unsigned int playoutDelay = 60;
+const int jitterPercentile = 95;
+const long minPlayoutDelay = 10;
+const long maxPlayoutDelay = 1500;
+
+// Forward error correction: every datagram also carries copies of up to fecRedundancy
+// frames sent before it within fecWindow millis (0 to 4), so the peer can rebuild a lost
+// frame from the next datagram. Copies it already has are dropped, and so are copies that
+// come in after they were due. The next frame may be an element or more away, later than
+// the playout delay, so after a run, edge or text frame, fecRepeats repeat datagrams go
+// fecRepeat millis apart with just the copies, until another frame follows it; a
+// straight key's key-down is repeated that often for as long as it is held. Keep
+// fecRepeat * fecRepeats well inside the playout delay.
+const int fecRedundancy = 2;
+const unsigned long fecWindow = 1500;
+const unsigned long fecRepeat = 15;
+const int fecRepeats = 2;
+
+// Server receive window. A frame that arrives ahead of a missing one is held up to
+// reorderWait millis for it, and for the repeats that would carry a copy of it. A run
+// that comes in more than latePlayoutLimit millis after it was due to play is dropped; a
+// less late one is played late, and the timeline catches up again in the following
+// character spaces.
+const unsigned long reorderWait = 30;
+const long latePlayoutLimit = 1000;
+
+// Datagrams read per pass of the main loop, at most. Whatever has come in is read in one
+// go, so a burst does not wait in the network stack, but a flood cannot starve the keying.
+const int receiveBatch = 8;
+
+// In straight key and vibroplex modes the client streams key edges. The server lets go of
+// a key-down that lasts longer than this many millis, in case the key-up was lost.
+const unsigned long maxRemoteMark = 5000;
+
+// Boot. The access point (BSSID and channel) is saved after each join, and the next boot
+// joins it directly, skipping the scan; if it does not answer within wifiCachedTimeout
+// millis, the keyer scans as usual. With cacheAddress set, the address DHCP gave last
+// time is reused as a static one, which saves the DHCP exchange too. Only set it if the
+// DHCP server always hands this keyer the same address.
+const unsigned long wifiCachedTimeout = 3000;
+const int cacheAddress = 0;
+
+// Telemetry. With statsHost set, both keyers send their link counters and histograms to
+// it every statsInterval millis, on statsPort (see Telemetry.h, and tools/stats.py to
+// collect them).
+const char * statsHost = "";
+const unsigned int statsPort = 4121;
+const unsigned long statsInterval = 5000;
+
+// Monitor listeners. The server sends on what it keys to every listener that has
+// subscribed in the last monitorTimeout millis, up to eight (see Monitor.h), and to the
+// multicast group monitorGroup, on port, when that is set. A server with monitorHost set
+// is a listener itself: it joins monitorGroup if that is set, or else subscribes to
+// monitorHost every monitorRefresh millis, and plays what it gets on its sidetone, never
+// its rig.
+const char * monitorGroup = "";
+const char * monitorHost = "";
+const unsigned long monitorRefresh = 10000;
+const unsigned long monitorTimeout = 30000;
+
+// Echo. With echoKeying set, the server reports each mark it keys back to the client, once
+// it has ended: when it was sent, how long after that it was keyed, and how long it was.
+// The client measures the round trip from its own key-down to the report, less the mark,
+// for the telemetry, and says on the serial port when the server's playout has slipped
+// more than echoWarnBehind millis behind, and when it has caught up again.
+const int echoKeying = 1;
+const long echoWarnBehind = 200;
\ No newline at end of file
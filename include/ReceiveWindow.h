@@ -0,0 +1,162 @@
+// Receive window over the peer's frame sequence numbers.
+
+// Frames are offered as they arrive, and handed back in sequence order. One
+// that arrives ahead of a gap is held for a short wait in case the missing
+// frame was only reordered (or turns up as a copy in a later datagram); after
+// that the gap is counted as lost and delivery moves on. A frame that arrives
+// after its turn has passed is late, and one already seen is a duplicate;
+// both are refused, however far back they are. The window only starts over
+// by itself when the count jumps far ahead. A peer that boots numbers its
+// frames from 1 again, which looks no different from late frames here: the
+// caller tells it apart by the session in the frame (WireFormat.h) and calls
+// reset().
+//
+// Take frames with next() after each offer(), and now and then in between so
+// held frames are released once their wait is up.
+
+#ifndef RECEIVEWINDOW_H
+#define RECEIVEWINDOW_H
+
+#include <stdint.h>
+
+const int receiveHistory = 64;            // Sequence numbers remembered for duplicates
+
+template <typename T, int slots>
+class ReceiveWindow {
+public:
+  ReceiveWindow() {
+    reset();
+    received = duplicates = late = lost = reordered = 0;
+  }
+
+  void reset() {
+    started = false;
+    expected = 0;
+    seen = 0;
+    readyHead = readyCount = 0;
+    for (int i = 0; i < slots; i++) {
+      held[i].used = false;
+      held[i].sequence = 0;
+    }
+  }
+
+  // Offer a frame that arrived at a given time. Returns false if it is refused.
+  bool offer(uint16_t sequence, const T &item, unsigned long now) {
+    int16_t d = (int16_t) (sequence - expected);
+
+    if (!started || d >= receiveHistory) {
+      restart(sequence);
+      d = 0;
+    }
+    if (d < 0) {
+      if (d >= -receiveHistory && (seen & ((uint64_t) 1 << (-d - 1)))) { duplicates++; }
+      else { late++; }
+      return false;
+    }
+    if (held[sequence % slots].used && held[sequence % slots].sequence == sequence) {
+      duplicates++;
+      return false;
+    }
+
+    // Too far ahead to hold: give up on the oldest gaps to make room.
+    while (d >= slots) {
+      advance();
+      d--;
+    }
+
+    received++;
+    if (d == 0 && heldCount()) { reordered++; }
+    Slot &slot = held[sequence % slots];
+    slot.item = item;
+    slot.sequence = sequence;
+    slot.arrival = now;
+    slot.used = true;
+    return true;
+  }
+
+  // Take the next frame in sequence, if there is one. A gap ahead of a frame
+  // that has waited longer than wait millis is skipped.
+  bool next(T &item, unsigned long now, unsigned long wait) {
+    while (!readyCount) {
+      Slot &slot = held[expected % slots];
+      if (slot.used && slot.sequence == expected) {
+        advance();
+        continue;
+      }
+      if (!overdue(now, wait)) { return false; }
+      advance();
+    }
+    item = ready[readyHead];
+    readyHead = (readyHead + 1) % slots;
+    readyCount--;
+    return true;
+  }
+
+  unsigned long received;                 // Frames accepted
+  unsigned long duplicates;               // Frames seen before
+  unsigned long late;                     // Frames that came after their turn
+  unsigned long lost;                     // Gaps given up on
+  unsigned long reordered;                // Frames that came after a later one
+
+private:
+  struct Slot {
+    T item;
+    uint16_t sequence;
+    unsigned long arrival;
+    bool used;
+  };
+
+  // Move delivery past the expected frame, readying it if it came.
+  void advance() {
+    Slot &slot = held[expected % slots];
+    bool came = slot.used && slot.sequence == expected;
+
+    if (came && readyCount < slots) {
+      ready[(readyHead + readyCount) % slots] = slot.item;
+      readyCount++;
+    } else {
+      lost++;
+    }
+    if (came) { slot.used = false; }
+    seen = (seen << 1) | (came ? 1 : 0);
+    expected++;
+  }
+
+  // Start over at a new sequence number, readying whatever is still held.
+  void restart(uint16_t sequence) {
+    if (started) {
+      while (heldCount()) {
+        Slot &slot = held[expected % slots];
+        if (slot.used && slot.sequence == expected) { advance(); }
+        else { expected++; }
+      }
+    }
+    started = true;
+    expected = sequence;
+    seen = 0;
+  }
+
+  // Some held frame has waited long enough for the gap before it.
+  bool overdue(unsigned long now, unsigned long wait) const {
+    for (int i = 0; i < slots; i++) {
+      if (held[i].used && now - held[i].arrival >= wait) { return true; }
+    }
+    return false;
+  }
+
+  int heldCount() const {
+    int n = 0;
+    for (int i = 0; i < slots; i++) { n += held[i].used; }
+    return n;
+  }
+
+  Slot held[slots];
+  T ready[slots];
+  int readyHead;
+  int readyCount;
+  bool started;
+  uint16_t expected;                      // Next sequence number to deliver
+  uint64_t seen;                          // bit n: expected - 1 - n was delivered
+};
+
+#endif
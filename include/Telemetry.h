@@ -0,0 +1,109 @@
+// Link telemetry.
+
+// Both keyers keep counters and histograms of how the remote link is doing,
+// and send them every statsInterval millis as a stats datagram, to statsHost
+// on statsPort (see Network.h), where tools/stats.py collects them. All of it
+// is cumulative since boot, so a lost datagram loses nothing, and the
+// collector works out the rates over each interval. Counters that are a
+// reading at the time (playout delay, jitter, queue depth) are sent as such.
+//
+// Stats datagram, with counts as unsigned LEB128 varints like the wire format:
+//   statsMagic, statsVersion, role (1 client, 2 server), varint uptime millis,
+//   varint n, n counters in the order of the stat constants below,
+//   varint h, h histograms, each a varint bin count and the bins.
+// Histogram bin 0 counts values of 0, bin b values from 2^(b-1) up to 2^b - 1
+// millis, and the last bin everything from there up. The mark error is the
+// one histogram in wireEdgeUnit instead, the resolution the echo carries.
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <WireFormat.h>
+
+const uint8_t statsMagic = 0x53;          // 'S', never a wire format header
+const uint8_t statsVersion = 1;
+const int statsBins = 12;                 // 0 ms, then powers of two up to 1024 ms and over
+const size_t statsMaxSize = 384;
+
+// Counters
+const int statFramesSent = 0;
+const int statFramesReceived = 1;         // accepted by the receive window
+const int statDuplicates = 2;
+const int statLate = 3;                   // came after their turn
+const int statLost = 4;
+const int statReordered = 5;
+const int statRecovered = 6;              // rebuilt from the copies in a later datagram
+const int statSlips = 7;                  // played late, the playout buffer ran dry
+const int statDrops = 8;                  // too late to play
+const int statPlayoutDelay = 9;           // now, millis
+const int statJitter = 10;                // now, RFC 3550 interarrival jitter in millis
+const int statRoundTrip = 11;             // now, best clock sync round trip in millis
+const int statQueueDepth = 12;            // now, elements, edges and characters waiting to play
+const int statQueuePeak = 13;
+const int statPaddleDrops = 14;           // paddle edges lost to a full queue
+const int statListeners = 15;             // now, monitor listeners the server sends on to
+const int statMonitorDrops = 16;          // datagrams not every listener got, sends behind
+const int statKeyingLag = 17;             // client, now: millis from sending a mark to the server keying it
+const int statServerBehind = 18;          // client, now: millis the server's playout has slipped
+const int statSendDrops = 19;             // datagrams to the peer dropped, sends behind
+const int statCount = 20;
+
+// Histograms
+const int histRoundTrip = 0;              // client: keepalive round trips
+const int histTransit = 1;                // server: frame transit above the fastest
+const int histWait = 2;                   // server: frame delivery to playout
+const int histEcho = 3;                   // client: key-down to the server's echo of it, less the mark
+const int histMarkError = 4;              // client: keyed mark against the one sent, either way, in wireEdgeUnit
+const int histCount = 5;
+
+
+class Histogram {
+public:
+  Histogram() { memset(bins, 0, sizeof(bins)); }
+
+  void add(long value) {
+    int bin = 0;
+    while (value > 0 && bin < statsBins - 1) {
+      value >>= 1;
+      bin++;
+    }
+    bins[bin]++;
+  }
+
+  uint32_t bins[statsBins];
+};
+
+
+class Telemetry {
+public:
+  Telemetry() { memset(counters, 0, sizeof(counters)); }
+
+  void count(int stat) { counters[stat]++; }
+  void set(int stat, long value) { counters[stat] = value > 0 ? value : 0; }
+  void peak(int stat, long value) { if (value > (long) counters[stat]) { counters[stat] = value; } }
+  void add(int hist, long value) { histograms[hist].add(value); }
+
+  // Encode the stats datagram. Returns its length, or 0 if it does not fit.
+  size_t encode(uint8_t *buf, size_t size, int role, uint32_t uptime) const {
+    if (size < 3) { return 0; }
+    buf[0] = statsMagic;
+    buf[1] = statsVersion;
+    buf[2] = role;
+    size_t pos = wirePutVarint(buf, 3, size, uptime);
+    if (pos) { pos = wirePutVarint(buf, pos, size, statCount); }
+    for (int i = 0; i < statCount && pos; i++) { pos = wirePutVarint(buf, pos, size, counters[i]); }
+    if (pos) { pos = wirePutVarint(buf, pos, size, histCount); }
+    for (int h = 0; h < histCount && pos; h++) {
+      pos = wirePutVarint(buf, pos, size, statsBins);
+      for (int b = 0; b < statsBins && pos; b++) { pos = wirePutVarint(buf, pos, size, histograms[h].bins[b]); }
+    }
+    return pos;
+  }
+
+  uint32_t counters[statCount];
+  Histogram histograms[histCount];
+};
+
+#endif
@@ -0,0 +1,123 @@
+// Keying timing table.
+
+// The speed is kept as a real WPM value, in tenths, and the length of every
+// mark and space is worked out from it in micros whenever a setting changes,
+// so the keyer engine only looks them up. A dit at w WPM is 1200000 / w
+// micros (PARIS, 50 dits, a minute at 1 WPM). The shape settings are the
+// WinKeyer ones:
+//   weight      50 for 1:1; each point above lengthens every mark by 2% of a
+//               dit, and shortens the space after it by as much (10 to 90)
+//   ratio       dah to dit, 50 for 3:1, so 33 is 2:1 and 66 is 4:1 (33 to 66)
+//   farnsworth  character speed in WPM: when it is above the speed, the
+//               characters are keyed at it, and the character and word spaces
+//               are stretched to bring PARIS back to the speed (0 for off)
+// Character and word spaces are kept as what is added after the space that
+// follows the last mark, so weighting does not change them.
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+const unsigned int timingMinWpm = 5;
+const unsigned int timingMaxWpm = 99;
+
+
+class KeyTiming {
+public:
+  KeyTiming(unsigned int speed) : tenths(speed), weighting(50), dahRatio(50), farnsworthWpm(0) { update(); }
+
+  // Set the speed, in tenths of WPM.
+  void setSpeed(unsigned int speed) {
+    if (speed < timingMinWpm * 10) { speed = timingMinWpm * 10; }
+    if (speed > timingMaxWpm * 10) { speed = timingMaxWpm * 10; }
+    tenths = speed;
+    update();
+  }
+
+  // Take every setting at once, as a remote sender gave them. Settings out of range are
+  // left as they were, as by the single setters.
+  void set(unsigned int speed, int weight, int ratio, unsigned int farnsworth) {
+    if (speed < timingMinWpm * 10) { speed = timingMinWpm * 10; }
+    if (speed > timingMaxWpm * 10) { speed = timingMaxWpm * 10; }
+    if (weight < 10 || weight > 90) { weight = weighting; }
+    if (ratio < 33 || ratio > 66) { ratio = dahRatio; }
+    if (farnsworth > timingMaxWpm) { farnsworth = 0; }
+    if (speed == tenths && weight == weighting && ratio == dahRatio && farnsworth == farnsworthWpm) { return; }
+    tenths = speed;
+    weighting = weight;
+    dahRatio = ratio;
+    farnsworthWpm = farnsworth;
+    update();
+  }
+
+  void setWeight(int weight) {
+    if (weight < 10 || weight > 90) { return; }
+    weighting = weight;
+    update();
+  }
+
+  void setRatio(int ratio) {
+    if (ratio < 33 || ratio > 66) { return; }
+    dahRatio = ratio;
+    update();
+  }
+
+  void setFarnsworth(unsigned int wpm) {
+    farnsworthWpm = wpm <= timingMaxWpm ? wpm : 0;
+    update();
+  }
+
+  unsigned int speed() const { return tenths; }
+  unsigned int wpm() const { return (tenths + 5) / 10; }
+  int weight() const { return weighting; }
+  int ratio() const { return dahRatio; }
+  unsigned int farnsworth() const { return farnsworthWpm; }
+
+  // The table, in micros.
+  uint32_t unit() const { return unitMicros; }             // a dit at the character speed, unweighted
+  uint32_t dit() const { return ditMark; }
+  uint32_t dah() const { return dahMark; }
+  uint32_t space() const { return markSpace; }             // after every mark
+  uint32_t character() const { return characterGap; }      // more after the last mark of a character
+  uint32_t word() const { return wordGap; }                // more again after the last character of a word
+  unsigned int ditMillis() const { return unitMillis; }    // unit, to the nearest milli
+
+private:
+  void update() {
+    unsigned int characterSpeed = (farnsworthWpm * 10 > tenths) ? farnsworthWpm * 10 : tenths;
+    unitMicros = 12000000UL / characterSpeed;
+    unitMillis = (unitMicros + 500) / 1000;
+
+    int32_t shift = (int32_t) unitMicros * (weighting - 50) / 50;
+    ditMark = unitMicros + shift;
+    dahMark = unitMicros * 3 * dahRatio / 50 + shift;
+    markSpace = unitMicros - shift;
+
+    characterGap = unitMicros * 2;
+    wordGap = unitMicros * 4;
+    if (characterSpeed > tenths) {
+      // PARIS at the speed takes 600000000 / tenths micros, 31 units of it marks and
+      // element spaces. The rest is its four character spaces and one word space, which
+      // take 3 and 7 nineteenths of it each.
+      uint32_t spare = 600000000UL / tenths - 31 * unitMicros;
+      characterGap = spare * 3 / 19 - unitMicros;
+      wordGap = spare * 4 / 19;
+    }
+  }
+
+  unsigned int tenths;
+  int weighting;
+  int dahRatio;
+  unsigned int farnsworthWpm;
+
+  uint32_t unitMicros;
+  unsigned int unitMillis;
+  uint32_t ditMark;
+  uint32_t dahMark;
+  uint32_t markSpace;
+  uint32_t characterGap;
+  uint32_t wordGap;
+};
+
+#endif
@@ -0,0 +1,171 @@
+// WinKeyer 2 host protocol.
+
+// Logging and contest programs drive a keyer over a serial port with the
+// K1EL WinKeyer command set: a byte from 0x20 up is text to send, and a
+// byte below that is a command, followed by a fixed number of argument
+// bytes (the admin and pointer commands take a sub-command first, which
+// sets how many more follow). Commands 0x18 to 0x1F are buffered: they go
+// into the type-ahead buffer with the text and take effect in sequence.
+// The keyer answers with status bytes (0xC0 and up), speed pot bytes (0x80
+// and up), and, when asked to, echoes each character as it is sent.
+//
+// WinKeyerParser only frames the bytes into commands; what they do is up to
+// the keyer.
+
+#ifndef WINKEYER_H
+#define WINKEYER_H
+
+#include <stdint.h>
+
+const uint8_t wkVersion = 23;             // Reported on host open: WK2.3
+
+// Immediate commands
+const uint8_t wkAdmin = 0x00;
+const uint8_t wkSidetone = 0x01;
+const uint8_t wkSpeed = 0x02;
+const uint8_t wkWeighting = 0x03;
+const uint8_t wkPttTiming = 0x04;
+const uint8_t wkSpeedPotSetup = 0x05;
+const uint8_t wkPause = 0x06;
+const uint8_t wkGetSpeedPot = 0x07;
+const uint8_t wkBackspace = 0x08;
+const uint8_t wkPinConfig = 0x09;
+const uint8_t wkClear = 0x0A;
+const uint8_t wkKeyImmediate = 0x0B;
+const uint8_t wkHscw = 0x0C;
+const uint8_t wkFarnsworth = 0x0D;
+const uint8_t wkMode = 0x0E;
+const uint8_t wkLoadDefaults = 0x0F;
+const uint8_t wkFirstExtension = 0x10;
+const uint8_t wkKeyCompensation = 0x11;
+const uint8_t wkPaddleSwitchpoint = 0x12;
+const uint8_t wkNull = 0x13;
+const uint8_t wkSoftwarePaddle = 0x14;
+const uint8_t wkGetStatus = 0x15;
+const uint8_t wkPointer = 0x16;
+const uint8_t wkRatio = 0x17;
+
+// Buffered commands
+const uint8_t wkBufferedPtt = 0x18;
+const uint8_t wkBufferedKey = 0x19;
+const uint8_t wkBufferedWait = 0x1A;
+const uint8_t wkMerge = 0x1B;
+const uint8_t wkBufferedSpeed = 0x1C;
+const uint8_t wkBufferedHscw = 0x1D;
+const uint8_t wkCancelSpeed = 0x1E;
+const uint8_t wkBufferedNop = 0x1F;
+
+// Admin sub-commands
+const uint8_t wkAdminReset = 0x01;
+const uint8_t wkAdminOpen = 0x02;
+const uint8_t wkAdminClose = 0x03;
+const uint8_t wkAdminEcho = 0x04;
+const uint8_t wkAdminLoadEeprom = 0x0D;
+
+// Pointer sub-commands
+const uint8_t wkPointerReset = 0x00;
+const uint8_t wkPointerOverwrite = 0x01;
+const uint8_t wkPointerAppend = 0x02;
+const uint8_t wkPointerNulls = 0x03;
+
+// Status byte
+const uint8_t wkStatus = 0xC0;
+const uint8_t wkStatusWait = 0x10;        // in a buffered wait
+const uint8_t wkStatusKeyDown = 0x08;
+const uint8_t wkStatusBusy = 0x04;        // sending
+const uint8_t wkStatusBreakIn = 0x02;     // paddles took over
+const uint8_t wkStatusXoff = 0x01;        // buffer more than two thirds full
+
+const uint8_t wkSpeedPot = 0x80;
+
+// Mode register bits
+const uint8_t wkModeSerialEcho = 0x04;
+
+
+// Argument bytes after a buffered command.
+inline int wkBufferedArgs(uint8_t command) {
+  switch (command) {
+    case wkBufferedPtt:
+    case wkBufferedKey:
+    case wkBufferedWait:
+    case wkBufferedSpeed:
+    case wkBufferedHscw:
+      return 1;
+    case wkMerge:
+      return 2;
+  }
+  return 0;
+}
+
+
+class WinKeyerParser {
+public:
+  WinKeyerParser() { reset(); }
+
+  void reset() {
+    count = 0;
+    needed = -1;
+  }
+
+  // Take a byte from the host. Returns true when it completes a command, which is then
+  // in command and args. A text byte is a command of its own, with no arguments.
+  bool feed(uint8_t b) {
+    if (needed < 0) {
+      command = b;
+      count = 0;
+      needed = argsFor(b);
+    } else {
+      if (count < maxArgs) { args[count] = b; }
+      count++;
+      if (count == 1 && (command == wkAdmin || command == wkPointer)) { needed += subArgs(command, b); }
+    }
+    if (count < needed) { return false; }
+    needed = -1;
+    return true;
+  }
+
+  static const int maxArgs = 16;
+
+  uint8_t command;
+  uint8_t args[maxArgs];
+  int count;
+
+private:
+  static int argsFor(uint8_t b) {
+    if (b >= 0x20) { return 0; }
+    if (b >= wkBufferedPtt) { return wkBufferedArgs(b); }
+    switch (b) {
+      case wkGetSpeedPot:
+      case wkBackspace:
+      case wkClear:
+      case wkNull:
+      case wkGetStatus:
+        return 0;
+      case wkPttTiming:
+        return 2;
+      case wkSpeedPotSetup:
+        return 3;
+      case wkLoadDefaults:
+        return 15;
+    }
+    return 1;                             // Admin and pointer: the sub-command, for now
+  }
+
+  static int subArgs(uint8_t command, uint8_t sub) {
+    if (command == wkPointer) { return sub == wkPointerNulls ? 1 : 0; }
+    switch (sub) {
+      case 0x00:                          // Calibrate
+      case wkAdminEcho:
+      case 0x0E:                          // Send message
+      case 0x0F:                          // Load X mode
+        return 1;
+      case wkAdminLoadEeprom:
+        return 256;
+    }
+    return 0;
+  }
+
+  int needed;                             // Bytes the command takes, -1 between commands
+};
+
+#endif
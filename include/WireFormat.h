@@ -0,0 +1,364 @@
+// Network wire format.
+
+// Every datagram starts with a header byte: the format version in the top
+// three bits, a stamped flag, and the frame type in the low four bits. Every
+// frame goes on with its sequence (2) and the sender's session (1), a number
+// the sender picks at random when it boots, so the receiver can tell a peer
+// that has started its count over from frames that are only late.
+// Multi-byte fields are big-endian, and counts and durations are unsigned
+// LEB128 varints, so frames are the same on every platform and only as long
+// as they need to be.
+//
+// Timing, in run, text and keepalive frames, the sender's whole timing table:
+//   varint (speed << 1 | shaped), [weight, ratio, farnsworth (1 each) if shaped].
+//   speed is in tenths of WPM, and the rest are as in Timing.h; a frame that is not
+//   shaped is keyed at weight 50, ratio 50 and no Farnsworth.
+// Run (wireChar, wireElement):
+//   header, sequence (2), session (1), [stamp (2) if stamped], varint gap, timing,
+//   varint count, elements packed one bit each (1 = dah), first element in the MSB.
+//   gap is the sender's silence before the run, from the end of the previous
+//   mark, in millis. stamp is the low 16 bits of the server time the run
+//   started, once the client has synchronized its clock.
+// Edges (wireEdge), for manual keying:
+//   header, sequence (2), session (1), [stamp (2) if stamped], varint (count << 1 | first edge is down),
+//   count varint spans. Edges alternate down and up. Span 0 is the time from the
+//   last edge of the sender's previous edge frame, each later span the time from the
+//   edge before, all in units of wireEdgeUnit micros. stamp is the server time of the
+//   first edge.
+// Text (wireText), for canned messages:
+//   header, sequence (2), session (1), [stamp (2) if stamped], timing, varint count, count
+//   bytes of text. The text is ASCII, with the prosign escapes of MorseTable.h, and
+//   letters between < and > run together; a count of 0 cancels any text still to
+//   play. stamp is the server time the first character started.
+// Repeat (wireRepeat): header, sequence (2) of the newest frame sent, session (1). It is no
+//   frame of its own, and takes no sequence number: it only carries copies of the last frames.
+// Keepalive: header, sequence (2), session (1), timing, t1 (4).
+// Ack:       header, sequence (2), session (1), t1 (4), t2 (4), t3 (4).
+// Subscribe: header, sequence (2), session (1). A monitor listener asks the server for what it keys.
+// Echo (wireEcho), server to client, for the marks it has keyed:
+//   header, sequence (2), session (1), varint depth, varint behind, varint count, count marks of
+//   sender (2), varint lag, varint mark. depth is the elements, edges and characters
+//   waiting to play, behind the millis the playout timeline has slipped. sender is the
+//   low 16 bits of the sender's time of the key-down, on the server clock, lag how many
+//   millis after that it was keyed, and mark its length in wireEdgeUnit.
+//
+// A datagram holds one frame, optionally followed by copies of earlier frames
+// for forward error correction, each as a varint length and the frame. A
+// receiver that only wants the first frame can ignore the rest.
+
+#ifndef WIREFORMAT_H
+#define WIREFORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+const uint8_t wireVersion = 3;            // 3: a session byte after the sequence
+const int wireMaxElements = 128;          // Longest run in one frame
+const int wireMaxText = 32;               // Most text bytes in one frame
+const int wireMaxEdges = 6;               // Most key edges in one frame
+const uint32_t wireEdgeUnit = 100;        // Edge timing resolution, in micros
+const int wireMaxEchoes = 4;              // Most keyed marks in one echo
+const int wireMaxRedundancy = 4;          // Most earlier frames carried in one datagram
+const size_t wireMaxVarint = 5;           // Longest varint, for 32 bits
+const size_t wireMaxTiming = 2 + 3;       // Longest timing: a speed up to 99.9 WPM, and the shape
+
+// Largest encoded frame of each type, with every field at its longest.
+const size_t wireMaxRun = 6 + wireMaxVarint + wireMaxTiming + 2 + wireMaxElements / 8;
+const size_t wireMaxEdgeFrame = 6 + 1 + wireMaxEdges * wireMaxVarint;
+const size_t wireMaxTextFrame = 6 + wireMaxTiming + 1 + wireMaxText;
+const size_t wireMaxEchoFrame = 4 + 3 + 3 + 1 + wireMaxEchoes * (2 + 3 + wireMaxVarint);
+
+// Largest encoded frame: an echo. The other types are checked against it.
+const size_t wireMaxSize = wireMaxEchoFrame;
+static_assert(wireMaxSize >= wireMaxRun && wireMaxSize >= wireMaxEdgeFrame && wireMaxSize >= wireMaxTextFrame,
+  "a frame type is larger than wireMaxSize");
+const size_t wireMaxDatagram = 1 + wireMaxRedundancy * (wireMaxSize + 1) + wireMaxSize;
+
+const uint8_t wireChar = 0;
+const uint8_t wireElement = 1;
+const uint8_t wireKeepAlive = 2;
+const uint8_t wireAck = 3;
+const uint8_t wireEdge = 4;
+const uint8_t wireText = 5;
+const uint8_t wireSubscribe = 6;
+const uint8_t wireEcho = 7;
+const uint8_t wireRepeat = 8;
+
+struct WireTiming {
+  uint16_t speed;                         // tenths of WPM
+  uint8_t weight;                         // 50 for 1:1
+  uint8_t ratio;                          // dah to dit, 50 for 3:1
+  uint8_t farnsworth;                     // character speed in WPM, 0 for off
+};
+
+struct WireEcho {
+  uint16_t sender;                        // key-down, sender time on the server clock
+  uint16_t lag;                           // millis after that it was keyed
+  uint32_t mark;                          // in wireEdgeUnit
+};
+
+struct WireFrame {
+  uint8_t type;
+  uint8_t stamped;
+  uint16_t sequence;
+  uint8_t session;                        // the sender's, for this boot
+  uint16_t stamp;
+  uint32_t gap;
+  WireTiming timing;                      // runs, text and keepalives
+  uint16_t length;                        // elements in the run, edges, text bytes, or echoes
+  uint8_t elements[wireMaxElements / 8];
+  uint8_t down;                           // edges: the first one is key-down
+  uint32_t spans[wireMaxEdges];           // edges: time before each, in wireEdgeUnit
+  char text[wireMaxText];
+  WireEcho echoes[wireMaxEchoes];
+  uint16_t depth;                         // echo: playout queue depth
+  uint16_t behind;                        // and slip, in millis
+  uint32_t t1;                            // clock sync: client send
+  uint32_t t2;                            // server receive
+  uint32_t t3;                            // server send
+};
+
+
+// Clear a frame to an empty run of a given type.
+inline void wireClear(WireFrame &f, uint8_t type) {
+  memset(&f, 0, sizeof(f));
+  f.type = type;
+}
+
+
+// Add an element to a run. Returns false when the run is full.
+inline bool wireAppend(WireFrame &f, int dah) {
+  if (f.length >= wireMaxElements) { return false; }
+  if (dah) { f.elements[f.length >> 3] |= 0x80 >> (f.length & 7); }
+  f.length++;
+  return true;
+}
+
+
+// Element i of a run: 1 for a dah, 0 for a dit.
+inline int wireElementAt(const WireFrame &f, int i) {
+  return (f.elements[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+
+// Add a key edge, span units after the one before. Returns false when the frame is full.
+inline bool wireAppendEdge(WireFrame &f, uint32_t span) {
+  if (f.length >= wireMaxEdges) { return false; }
+  f.spans[f.length++] = span;
+  return true;
+}
+
+
+// Encoding helpers. Each returns the new position, or 0 when out of room.
+
+inline size_t wirePutVarint(uint8_t *buf, size_t pos, size_t size, uint32_t value) {
+  do {
+    if (pos >= size) { return 0; }
+    uint8_t b = value & 0x7F;
+    value >>= 7;
+    buf[pos++] = b | (value ? 0x80 : 0);
+  } while (value);
+  return pos;
+}
+
+
+inline size_t wirePutBig(uint8_t *buf, size_t pos, size_t size, uint32_t value, int bytes) {
+  if (!pos || pos + bytes > size) { return 0; }
+  for (int i = bytes - 1; i >= 0; i--) { buf[pos++] = (value >> (i * 8)) & 0xFF; }
+  return pos;
+}
+
+
+inline size_t wireGetVarint(const uint8_t *buf, size_t pos, size_t size, uint32_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (!pos || pos >= size) { return 0; }
+    uint8_t b = buf[pos++];
+    value |= (uint32_t) (b & 0x7F) << shift;
+    if (!(b & 0x80)) { return pos; }
+  }
+  return 0;
+}
+
+
+inline size_t wireGetBig(const uint8_t *buf, size_t pos, size_t size, uint32_t &value, int bytes) {
+  value = 0;
+  if (!pos || pos + bytes > size) { return 0; }
+  for (int i = 0; i < bytes; i++) { value = (value << 8) | buf[pos++]; }
+  return pos;
+}
+
+
+inline size_t wirePutTiming(uint8_t *buf, size_t pos, size_t size, const WireTiming &t) {
+  int shaped = t.weight != 50 || t.ratio != 50 || t.farnsworth;
+  if (pos) { pos = wirePutVarint(buf, pos, size, ((uint32_t) t.speed << 1) | shaped); }
+  if (pos && shaped) { pos = wirePutBig(buf, pos, size, ((uint32_t) t.weight << 16) | (t.ratio << 8) | t.farnsworth, 3); }
+  return pos;
+}
+
+
+inline size_t wireGetTiming(const uint8_t *buf, size_t pos, size_t size, WireTiming &t) {
+  uint32_t v;
+  pos = wireGetVarint(buf, pos, size, v);
+  t.speed = v >> 1;
+  t.weight = 50;
+  t.ratio = 50;
+  t.farnsworth = 0;
+  if (pos && (v & 1)) {
+    pos = wireGetBig(buf, pos, size, v, 3);
+    t.weight = v >> 16;
+    t.ratio = v >> 8;
+    t.farnsworth = v;
+  }
+  return pos;
+}
+
+
+// Encode a frame. Returns its length, or 0 if it does not fit.
+inline size_t wireEncode(const WireFrame &f, uint8_t *buf, size_t size) {
+  if (!size) { return 0; }
+  buf[0] = (wireVersion << 5) | (f.stamped ? 0x10 : 0) | (f.type & 0x0F);
+  size_t pos = wirePutBig(buf, 1, size, f.sequence, 2);
+  pos = wirePutBig(buf, pos, size, f.session, 1);
+
+  switch (f.type) {
+    case wireChar:
+    case wireElement:
+      if (f.stamped) { pos = wirePutBig(buf, pos, size, f.stamp, 2); }
+      if (pos) { pos = wirePutVarint(buf, pos, size, f.gap); }
+      pos = wirePutTiming(buf, pos, size, f.timing);
+      if (pos) { pos = wirePutVarint(buf, pos, size, f.length); }
+      if (pos) {
+        size_t bytes = (f.length + 7) / 8;
+        if (pos + bytes > size) { return 0; }
+        memcpy(buf + pos, f.elements, bytes);
+        pos += bytes;
+      }
+      break;
+    case wireEdge:
+      if (f.stamped) { pos = wirePutBig(buf, pos, size, f.stamp, 2); }
+      if (f.length > wireMaxEdges) { return 0; }
+      if (pos) { pos = wirePutVarint(buf, pos, size, (f.length << 1) | (f.down ? 1 : 0)); }
+      for (int i = 0; i < f.length && pos; i++) { pos = wirePutVarint(buf, pos, size, f.spans[i]); }
+      break;
+    case wireText:
+      if (f.stamped) { pos = wirePutBig(buf, pos, size, f.stamp, 2); }
+      if (f.length > wireMaxText) { return 0; }
+      pos = wirePutTiming(buf, pos, size, f.timing);
+      if (pos) { pos = wirePutVarint(buf, pos, size, f.length); }
+      if (pos) {
+        if (pos + f.length > size) { return 0; }
+        memcpy(buf + pos, f.text, f.length);
+        pos += f.length;
+      }
+      break;
+    case wireKeepAlive:
+      pos = wirePutTiming(buf, pos, size, f.timing);
+      pos = wirePutBig(buf, pos, size, f.t1, 4);
+      break;
+    case wireAck:
+      pos = wirePutBig(buf, pos, size, f.t1, 4);
+      pos = wirePutBig(buf, pos, size, f.t2, 4);
+      pos = wirePutBig(buf, pos, size, f.t3, 4);
+      break;
+    case wireSubscribe:
+    case wireRepeat:
+      break;
+    case wireEcho:
+      if (f.length > wireMaxEchoes) { return 0; }
+      if (pos) { pos = wirePutVarint(buf, pos, size, f.depth); }
+      if (pos) { pos = wirePutVarint(buf, pos, size, f.behind); }
+      if (pos) { pos = wirePutVarint(buf, pos, size, f.length); }
+      for (int i = 0; i < f.length && pos; i++) {
+        pos = wirePutBig(buf, pos, size, f.echoes[i].sender, 2);
+        if (pos) { pos = wirePutVarint(buf, pos, size, f.echoes[i].lag); }
+        if (pos) { pos = wirePutVarint(buf, pos, size, f.echoes[i].mark); }
+      }
+      break;
+    default:
+      return 0;
+  }
+  return pos;
+}
+
+
+// Decode a frame. Returns its length, or 0 for a frame of another version, or a damaged one.
+inline size_t wireDecode(const uint8_t *buf, size_t size, WireFrame &f) {
+  uint32_t v;
+
+  if (size < 4 || (buf[0] >> 5) != wireVersion) { return 0; }
+  wireClear(f, buf[0] & 0x0F);
+  f.stamped = (buf[0] & 0x10) != 0;
+  size_t pos = wireGetBig(buf, 1, size, v, 2);
+  f.sequence = v;
+  pos = wireGetBig(buf, pos, size, v, 1);
+  f.session = v;
+
+  switch (f.type) {
+    case wireChar:
+    case wireElement:
+      if (f.stamped) {
+        pos = wireGetBig(buf, pos, size, v, 2);
+        f.stamp = v;
+      }
+      pos = wireGetVarint(buf, pos, size, f.gap);
+      pos = wireGetTiming(buf, pos, size, f.timing);
+      pos = wireGetVarint(buf, pos, size, v);
+      if (!pos || v > wireMaxElements || pos + (v + 7) / 8 > size) { return 0; }
+      f.length = v;
+      memcpy(f.elements, buf + pos, (v + 7) / 8);
+      return pos + (v + 7) / 8;
+    case wireEdge:
+      if (f.stamped) {
+        pos = wireGetBig(buf, pos, size, v, 2);
+        f.stamp = v;
+      }
+      pos = wireGetVarint(buf, pos, size, v);
+      if (!pos || (v >> 1) > (uint32_t) wireMaxEdges) { return 0; }
+      f.length = v >> 1;
+      f.down = v & 1;
+      for (int i = 0; i < f.length && pos; i++) { pos = wireGetVarint(buf, pos, size, f.spans[i]); }
+      return pos;
+    case wireText:
+      if (f.stamped) {
+        pos = wireGetBig(buf, pos, size, v, 2);
+        f.stamp = v;
+      }
+      pos = wireGetTiming(buf, pos, size, f.timing);
+      pos = wireGetVarint(buf, pos, size, v);
+      if (!pos || v > (uint32_t) wireMaxText || pos + v > size) { return 0; }
+      f.length = v;
+      memcpy(f.text, buf + pos, v);
+      return pos + v;
+    case wireKeepAlive:
+      pos = wireGetTiming(buf, pos, size, f.timing);
+      return wireGetBig(buf, pos, size, f.t1, 4);
+    case wireAck:
+      pos = wireGetBig(buf, pos, size, f.t1, 4);
+      pos = wireGetBig(buf, pos, size, f.t2, 4);
+      return wireGetBig(buf, pos, size, f.t3, 4);
+    case wireSubscribe:
+    case wireRepeat:
+      return pos;
+    case wireEcho:
+      pos = wireGetVarint(buf, pos, size, v);
+      f.depth = v;
+      pos = wireGetVarint(buf, pos, size, v);
+      f.behind = v;
+      pos = wireGetVarint(buf, pos, size, v);
+      if (!pos || v > (uint32_t) wireMaxEchoes) { return 0; }
+      f.length = v;
+      for (int i = 0; i < f.length && pos; i++) {
+        pos = wireGetBig(buf, pos, size, v, 2);
+        f.echoes[i].sender = v;
+        pos = wireGetVarint(buf, pos, size, v);
+        f.echoes[i].lag = v;
+        pos = wireGetVarint(buf, pos, size, f.echoes[i].mark);
+      }
+      return pos;
+  }
+  return 0;
+}
+
+#endif
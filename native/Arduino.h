@@ -0,0 +1,123 @@
+// Native stand-in for the ESP8266 Arduino core API used by the keyer.
+// See hal.h for the virtual clock and pin model behind these calls.
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+// The ESP8266 core takes these from the standard library too.
+using std::min;
+using std::max;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x00
+#define INPUT_PULLUP 0x02
+#define OUTPUT 0x01
+
+#define TIM_DIV1 0
+#define TIM_DIV16 1
+#define TIM_DIV256 3
+#define TIM_EDGE 0
+#define TIM_LEVEL 1
+#define TIM_SINGLE 0
+#define TIM_LOOP 1
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// NodeMCU pin map
+static const uint8_t D0 = 16;
+static const uint8_t D1 = 5;
+static const uint8_t D2 = 4;
+static const uint8_t D3 = 0;
+static const uint8_t D4 = 2;
+static const uint8_t D5 = 14;
+static const uint8_t D6 = 12;
+static const uint8_t D7 = 13;
+static const uint8_t D8 = 15;
+static const uint8_t PIN_A0 = 17;
+static const uint8_t A0 = 17;
+
+// GPIO set/clear registers, used by Pinflip.h.
+extern volatile uint32_t GPOS;
+extern volatile uint32_t GPOC;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration = 0);
+void noTone(uint8_t pin);
+
+#define digitalPinToInterrupt(p) (p)
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t pin);
+void interrupts();
+void noInterrupts();
+
+void timer1_attachInterrupt(void (*handler)(void));
+void timer1_detachInterrupt();
+void timer1_enable(uint8_t divider, uint8_t type, uint8_t reload);
+void timer1_disable();
+void timer1_write(uint32_t ticks);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+char *itoa(int value, char *result, int base);
+
+
+class HardwareSerial {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  size_t print(const char *s);
+  size_t print(char c);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+  size_t println() { return print("\n"); }
+  int available();
+  int read();
+  size_t write(uint8_t b);
+  template<typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+  template<typename T> size_t println(T v, int f) { size_t n = print(v, f); return n + println(); }
+};
+
+extern HardwareSerial Serial;
+
+
+// The chip's random number generator. Natively a fixed sequence, so runs repeat, and one
+// that goes on across boards, so each boot draws a different number.
+class EspClass {
+public:
+  uint32_t random() const;
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,25 @@
+// Native stand-in for the EEPROM_Rotate library, backed by the board's
+// flash image in hal.h. Rotation is not modelled, only commits are counted.
+
+#ifndef EEPROM_ROTATE_H
+#define EEPROM_ROTATE_H
+
+#include <hal.h>
+
+class EEPROM_Rotate {
+public:
+  bool size(uint8_t sectors) { (void)sectors; return true; }
+  void begin(size_t size) { hal::board->eepromSize = size; }
+  uint8_t read(int address) {
+    return (address >= 0 && (size_t)address < hal::board->eepromSize) ? hal::board->eeprom[address] : 0xFF;
+  }
+  void write(int address, uint8_t value) {
+    if (address >= 0 && (size_t)address < hal::board->eepromSize) { hal::board->eeprom[address] = value; }
+  }
+  bool commit() {
+    hal::board->commits++;
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,74 @@
+// Native stand-in for the ESP8266WiFi library. Association always succeeds,
+// joinTime virtual micros after begin(), or joinTimeCached if the BSSID and
+// channel are given (both set on the board, and 0 by default).
+
+#ifndef ESP8266WIFI_H
+#define ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <hal.h>
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+  WIFI_NONE_SLEEP = 0,
+  WIFI_LIGHT_SLEEP = 1,
+  WIFI_MODEM_SLEEP = 2
+} WiFiSleepType_t;
+
+class IPAddress {
+public:
+  IPAddress() : addr(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : addr(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+  operator uint32_t() const { return addr; }
+  bool fromString(const char *s) {
+    unsigned int a, b, c, d;
+    if (sscanf(s, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 || a > 255 || b > 255 || c > 255 || d > 255) { return false; }
+    addr = a | (b << 8) | (c << 16) | ((uint32_t)d << 24);
+    return true;
+  }
+  uint8_t operator[](int i) const { return (addr >> (i * 8)) & 0xFF; }
+  uint32_t addr;
+};
+
+class ESP8266WiFiClass {
+public:
+  wl_status_t begin(const char *ssid, const char *passphrase, int32_t channel = 0, const uint8_t *bssid = 0) {
+    (void)ssid;
+    (void)passphrase;
+    hal::board->joined = 1;
+    hal::board->joinedAt = hal::nowUs + ((channel && bssid) ? hal::board->joinTimeCached : hal::board->joinTime);
+    return status();
+  }
+  bool config(IPAddress local, IPAddress gateway, IPAddress subnet) {
+    ip = local ? local : IPAddress(127, 0, 0, 1);
+    this->gateway = gateway;
+    this->subnet = subnet;
+    return true;
+  }
+  wl_status_t status() {
+    return (hal::board->joined && hal::nowUs >= hal::board->joinedAt) ? WL_CONNECTED : WL_DISCONNECTED;
+  }
+  bool setSleepMode(WiFiSleepType_t type) { (void)type; return true; }
+  IPAddress localIP() { return ip; }
+  IPAddress gatewayIP() { return gateway; }
+  IPAddress subnetMask() { return subnet; }
+  uint8_t *BSSID() { return bssid; }
+  int32_t channel() { return 6; }
+
+private:
+  IPAddress ip = IPAddress(127, 0, 0, 1);
+  IPAddress gateway = IPAddress(127, 0, 0, 1);
+  IPAddress subnet = IPAddress(255, 0, 0, 0);
+  uint8_t bssid[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,72 @@
+// Native stand-in for the ESP8266 LittleFS filesystem, backed by the board's
+// file map in hal.h. Only what the keyer uses: open for read or write,
+// exists, remove and rename. Writes land when the file is closed.
+
+#ifndef LITTLEFS_H
+#define LITTLEFS_H
+
+#include <hal.h>
+
+class File {
+public:
+  File() : open(false), writing(false), pos(0) {}
+  File(const std::string &path, bool writing) : path(path), open(true), writing(writing), pos(0) {
+    if (!writing) { data = hal::board->files[path]; }
+  }
+
+  operator bool() const { return open; }
+  size_t size() const { return data.size(); }
+
+  size_t read(uint8_t *buffer, size_t size) {
+    if (!open || writing) { return 0; }
+    size_t n = data.size() - pos;
+    if (n > size) { n = size; }
+    memcpy(buffer, data.data() + pos, n);
+    pos += n;
+    return n;
+  }
+
+  size_t write(const uint8_t *buffer, size_t size) {
+    if (!open || !writing) { return 0; }
+    data.insert(data.end(), buffer, buffer + size);
+    return size;
+  }
+
+  void close() {
+    if (open && writing) { hal::board->files[path] = data; }
+    open = false;
+  }
+
+private:
+  std::string path;
+  bool open;
+  bool writing;
+  size_t pos;
+  std::vector<uint8_t> data;
+};
+
+class LittleFSClass {
+public:
+  bool begin() { return true; }
+  bool format() {
+    hal::board->files.clear();
+    return true;
+  }
+  bool exists(const char *path) { return hal::board->files.count(path) != 0; }
+  bool remove(const char *path) { return hal::board->files.erase(path) != 0; }
+  bool rename(const char *from, const char *to) {
+    if (!exists(from)) { return false; }
+    hal::board->files[to] = hal::board->files[from];
+    hal::board->files.erase(from);
+    return true;
+  }
+  File open(const char *path, const char *mode) {
+    bool writing = mode[0] == 'w';
+    if (!writing && !exists(path)) { return File(); }
+    return File(path, writing);
+  }
+};
+
+extern LittleFSClass LittleFS;
+
+#endif
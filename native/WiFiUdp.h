@@ -0,0 +1,70 @@
+// Native stand-in for WiFiUDP. Sent datagrams are logged on the board,
+// received datagrams are taken from the board's receive queue. Addresses
+// are not emulated: every datagram comes from 127.0.0.1, on the keyer port.
+
+#ifndef WIFIUDP_H
+#define WIFIUDP_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <hal.h>
+
+class WiFiUDP {
+public:
+  uint8_t begin(uint16_t port) { (void)port; return 1; }
+  uint8_t beginMulticast(IPAddress interfaceAddr, IPAddress multicast, uint16_t port) {
+    (void)interfaceAddr;
+    (void)multicast;
+    return begin(port);
+  }
+  int beginPacket(const char *host, uint16_t port) {
+    (void)host;
+    (void)port;
+    out.clear();
+    return 1;
+  }
+  int beginPacket(IPAddress ip, uint16_t port) {
+    (void)ip;
+    return beginPacket("", port);
+  }
+  int beginPacketMulticast(IPAddress multicast, uint16_t port, IPAddress interfaceAddr, int ttl = 1) {
+    (void)interfaceAddr;
+    (void)ttl;
+    return beginPacket(multicast, port);
+  }
+  size_t write(const char *buffer, size_t size) {
+    out.insert(out.end(), buffer, buffer + size);
+    return size;
+  }
+  size_t write(const uint8_t *buffer, size_t size) { return write((const char *)buffer, size); }
+  int endPacket() {
+    hal::board->txLog.push_back(out);
+    return 1;
+  }
+  int parsePacket() {
+    in.clear();
+    inPos = 0;
+    if (hal::board->rxQueue.empty()) { return 0; }
+    in = hal::board->rxQueue.front();
+    hal::board->rxQueue.pop_front();
+    return (int)in.size();
+  }
+  int read(char *buffer, size_t len) {
+    size_t n = in.size() - inPos;
+    if (n > len) { n = len; }
+    memcpy(buffer, in.data() + inPos, n);
+    inPos += n;
+    return (int)n;
+  }
+  int read(uint8_t *buffer, size_t len) { return read((char *)buffer, len); }
+  int available() { return (int)(in.size() - inPos); }
+  IPAddress remoteIP() { return IPAddress(127, 0, 0, 1); }
+  uint16_t remotePort() { return 4120; }
+
+private:
+  std::vector<uint8_t> out;
+  std::vector<uint8_t> in;
+  size_t inPos = 0;
+};
+
+#endif
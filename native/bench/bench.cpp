@@ -0,0 +1,307 @@
+// Keying accuracy benchmark.
+
+// Boots the keyer on the virtual clock and keys a set of cases at each speed,
+// comparing the key line with a golden waveform: the same text at ideal
+// timing, a dit mark and element space of one unit, a dah of three, and
+// spaces of three units between characters and seven between words. The
+// cases cover every way the keyer makes a key line:
+//   paddles    PARIS PARIS keyed one paddle at a time, through processPaddles()
+//   squeeze A  squeezes released during the last element, in iambic mode A
+//   squeeze B  the same squeezes released an element earlier, which mode B completes
+//   insert     the dah paddle held, with the dit paddle tapped during the dahs
+//   memory     PARIS PARIS played from a memory, through playMemory()
+//   text       PARIS PARIS typed into the WinKeyer host buffer, through hostCommand()
+// For each it reports the mark error, the weight error (dit mark against dit
+// plus element space, in percent of the 50% ideal), and the element,
+// character and word space errors, all in millis, as mean / worst. A case
+// whose elements are not the golden ones is marked FAIL. The first mark is
+// taken as the reference, so paddle latency does not count.
+// The exit status is 1 if any case fails, or any error is outside the budget.
+//
+// Usage: bench [-b budget ms] [-v] [wpm ...]
+// -v lists each key line edge by edge against the golden one.
+
+#include <Arduino.h>
+#include <hal.h>
+#include <string>
+#include <MorseTable.h>
+#include <MemoryBank.h>
+#include <Timing.h>
+#include <WinKeyer.h>
+
+#ifndef WINKEYER
+#error "The text case keys through the WinKeyer host buffer: build with -D WINKEYER"
+#endif
+
+extern KeyTiming timing;
+extern int iambicModeB;
+extern MemoryBank memories;
+extern WinKeyerParser hostParser;
+void setup();
+void loop();
+void playMemory(int memoryId);
+void hostCommand(const WinKeyerParser &p);
+
+// Pin assignments from keyer.cpp (those are const, so not linkable).
+const int pinKeyDit = D5;
+const int pinKeyDah = D6;
+const int pinMosfet = D0;
+
+const int benchSlot = 0;                  // Memory the memory case plays
+const uint64_t settleUs = 2000000;        // Left idle before and after each case
+
+
+struct Mark {
+  uint64_t down;
+  uint64_t up;
+  int dah;
+  int space;                              // golden space after, in units (0 after the last)
+};
+
+
+struct Stats {
+  unsigned long count;
+  double sum;
+  double worst;
+
+  void add(double v) {
+    count++;
+    sum += v;
+    if (fabs(v) > fabs(worst)) { worst = v; }
+  }
+  double mean() const { return count ? sum / count : 0; }
+};
+
+
+enum Source { sourcePaddles, sourceSqueezeA, sourceSqueezeB, sourceInsert, sourceMemory, sourceText };
+
+struct Case {
+  const char *name;
+  Source source;
+  const char *golden;
+};
+
+const Case cases[] = {
+  { "paddles", sourcePaddles, "PARIS PARIS" },
+  { "squeeze A", sourceSqueezeA, "N R" },
+  { "squeeze B", sourceSqueezeB, "K <AA>" },
+  { "insert", sourceInsert, "K C" },
+  { "memory", sourceMemory, "PARIS PARIS" },
+  { "text", sourceText, "PARIS PARIS" },
+};
+
+
+// Run the keyer loop until the virtual clock reaches a time.
+static void runUntil(uint64_t until) {
+  while (hal::nowUs < until) { loop(); }
+}
+
+
+// The ideal key line for a text, from a time. Letters between < and > run together.
+static std::vector<Mark> golden(const char *text, uint64_t at, uint64_t unit) {
+  std::vector<Mark> result;
+  MorseCode code = { 0, 0, 0 };
+  int prosign = 0;
+
+  for (const char *p = text; ; p++) {
+    if (*p == '<') {
+      prosign = 1;
+      continue;
+    }
+    if (*p == '>') { prosign = 0; }
+    else if (*p && *p != ' ') {
+      code = morseMerge(code, morseTable[*p]);
+      if (prosign) { continue; }
+    }
+
+    for (int i = 0; i < code.length; i++) {
+      int dah = morseElementAt(code, i);
+      uint64_t mark = unit * (dah ? 3 : 1);
+      result.push_back({ at, at + mark, dah, 1 });
+      at += mark + unit;
+    }
+    if (code.length) {
+      result.back().space = 3;
+      at += unit * 2;
+    }
+    if (*p == ' ' && !result.empty()) {
+      result.back().space = 7;
+      at += unit * 4;
+    }
+    code = MorseCode { 0, 0, 0 };
+    if (!*p) { break; }
+  }
+  if (!result.empty()) { result.back().space = 0; }
+  return result;
+}
+
+
+// The elements of each character in a golden line, as index ranges.
+static std::vector<std::pair<size_t, size_t>> characters(const std::vector<Mark> &line) {
+  std::vector<std::pair<size_t, size_t>> result;
+  size_t first = 0;
+  for (size_t i = 0; i < line.size(); i++) {
+    if (line[i].space == 1) { continue; }
+    result.push_back({ first, i });
+    first = i + 1;
+  }
+  return result;
+}
+
+
+// Script the paddles to key a golden line.
+static void scriptPaddles(const std::vector<Mark> &line, Source source, uint64_t unit) {
+  for (const std::pair<size_t, size_t> &c : characters(line)) {
+    const Mark &first = line[c.first];
+    const Mark &last = line[c.second];
+
+    switch (source) {
+      case sourcePaddles:
+        for (size_t i = c.first; i <= c.second; i++) {
+          hal::press(*hal::board, line[i].dah ? pinKeyDah : pinKeyDit, line[i].down, unit / 2);
+        }
+        break;
+      case sourceSqueezeA:
+      case sourceSqueezeB: {
+        // Squeeze from the first element, the other paddle a moment after, and let go
+        // during the last element, or in mode B during the one before, which it completes.
+        const Mark &release = (source == sourceSqueezeB) ? line[c.second - 1] : last;
+        uint64_t held = (release.down + release.up) / 2 - first.down;
+        hal::press(*hal::board, first.dah ? pinKeyDah : pinKeyDit, first.down, held);
+        hal::press(*hal::board, first.dah ? pinKeyDit : pinKeyDah, first.down + unit / 4, held - unit / 4);
+        break;
+      }
+      default:
+        // Hold the dah paddle through the character, and tap the dit paddle during each
+        // dah that has a dit after it.
+        hal::press(*hal::board, pinKeyDah, first.down, (last.down + last.up) / 2 - first.down);
+        for (size_t i = c.first; i < c.second; i++) {
+          if (line[i].dah && !line[i + 1].dah) { hal::press(*hal::board, pinKeyDit, line[i].down + unit, 4000); }
+        }
+    }
+  }
+}
+
+
+// Record a golden line as a memory: the codes a perfectly timed recording holds, 0 for
+// a dit, 1 for a dah, and 4 more than the thirds of a dit of space beyond the element
+// space.
+static void recordMemory(const std::vector<Mark> &line) {
+  memories.startRecord(benchSlot);
+  for (const Mark &m : line) {
+    memories.record(m.dah);
+    if (m.space > 1) { memories.record(4 + (m.space - 1) * 3); }
+  }
+  memories.endRecord();
+}
+
+
+// The marks on the key line logged since a given index.
+static std::vector<Mark> marks(size_t from) {
+  std::vector<Mark> result;
+  for (size_t i = from; i < hal::board->log.size(); i++) {
+    const hal::Edge &e = hal::board->log[i];
+    if (e.pin != pinMosfet) { continue; }
+    if (e.level == HIGH) { result.push_back({ e.at, 0, 0, 0 }); }
+    else if (!result.empty() && !result.back().up) { result.back().up = e.at; }
+  }
+  return result;
+}
+
+
+static void printLine(const char *name, const std::vector<Mark> &line, uint64_t from) {
+  printf("  %-7s", name);
+  for (const Mark &m : line) { printf(" %.1f-%.1f", ((int64_t) m.down - (int64_t) from) / 1000.0, ((int64_t) m.up - (int64_t) from) / 1000.0); }
+  printf("\n");
+}
+
+
+int main(int argc, char **argv) {
+  double budget = 1.0;
+  int verbose = 0;
+  std::vector<int> speeds;
+
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    if (a == "-b" && i + 1 < argc) { budget = atof(argv[++i]); }
+    else if (a == "-v") { verbose = 1; }
+    else { speeds.push_back(atoi(argv[i])); }
+  }
+  if (speeds.empty()) { speeds = { 5, 10, 15, 20, 25, 30, 35, 40, 50, 60 }; }
+
+  hal::reset(*hal::board);
+  setup();
+  runUntil(hal::nowUs + 3000000);         // Let the boot announcement finish
+
+  printf("%4s %-9s %5s %16s %8s %16s %16s %16s\n", "WPM", "case", "marks", "mark err ms", "weight %",
+    "space err ms", "char sp err ms", "word sp err ms");
+  printf("%4s %-9s %5s %16s %8s %16s %16s %16s\n", "", "", "", "mean / worst", "mean", "mean / worst",
+    "mean / worst", "mean / worst");
+
+  int failed = 0;
+  for (size_t s = 0; s < speeds.size(); s++) {
+    timing.setSpeed(speeds[s] * 10);
+    uint64_t unit = timing.unit();
+
+    for (const Case &c : cases) {
+      uint64_t start = hal::nowUs + settleUs;
+      std::vector<Mark> ideal = golden(c.golden, start, unit);
+      size_t from = hal::board->log.size();
+
+      iambicModeB = (c.source != sourceSqueezeA);
+      switch (c.source) {
+        case sourceMemory:
+          recordMemory(ideal);
+          runUntil(start);
+          playMemory(benchSlot);
+          break;
+        case sourceText:
+          runUntil(start);
+          for (const char *p = c.golden; *p; p++) {
+            if (hostParser.feed(*p)) { hostCommand(hostParser); }
+          }
+          break;
+        default:
+          scriptPaddles(ideal, c.source, unit);
+      }
+      runUntil(ideal.back().up + settleUs);
+
+      std::vector<Mark> line = marks(from);
+      int ok = line.size() == ideal.size();
+      for (size_t i = 0; ok && i < line.size(); i++) { ok = ((line[i].up - line[i].down) >= 2 * unit) == ideal[i].dah; }
+
+      Stats mark = {}, weight = {}, space = {}, charSpace = {}, wordSpace = {};
+      uint64_t offset = line.empty() ? 0 : line[0].down - ideal[0].down;
+      for (size_t i = 0; ok && i < line.size(); i++) {
+        double length = line[i].up - line[i].down;
+        mark.add((length - (ideal[i].up - ideal[i].down)) / 1000.0);
+        if (i + 1 == line.size()) { continue; }
+        double gap = line[i + 1].down - line[i].up;
+        double error = (gap - ideal[i].space * (double) unit) / 1000.0;
+        if (ideal[i].space == 1) {
+          space.add(error);
+          if (!ideal[i].dah) { weight.add(100.0 * length / (length + gap) - 50.0); }
+        } else if (ideal[i].space == 3) {
+          charSpace.add(error);
+        } else {
+          wordSpace.add(error);
+        }
+      }
+
+      double worst = std::max(std::max(fabs(mark.worst), fabs(space.worst)), std::max(fabs(charSpace.worst), fabs(wordSpace.worst)));
+      int pass = ok && worst <= budget;
+      if (!pass) { failed = 1; }
+
+      printf("%4d %-9s %5zu %7.3f / %6.3f %8.3f %7.3f / %6.3f %7.3f / %6.3f %7.3f / %6.3f%s\n",
+        speeds[s], c.name, line.size(), mark.mean(), mark.worst, weight.mean(),
+        space.mean(), space.worst, charSpace.mean(), charSpace.worst, wordSpace.mean(), wordSpace.worst,
+        !ok ? "  FAIL" : (pass ? "" : "  over budget"));
+      if (verbose) {
+        printLine("golden", ideal, start);
+        printLine("keyed", line, start + offset);
+      }
+    }
+  }
+
+  return failed;
+}
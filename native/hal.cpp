@@ -0,0 +1,409 @@
+// Native hardware abstraction layer - see hal.h.
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include <algorithm>
+#include <hal.h>
+
+volatile uint32_t GPOS = 0;
+volatile uint32_t GPOC = 0;
+
+HardwareSerial Serial;
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+LittleFSClass LittleFS;
+
+namespace hal {
+
+uint64_t nowUs = 0;
+static Board defaultBoard;
+Board *board = &defaultBoard;
+static std::vector<Board *> attached;     // Boards sharing the clock
+
+
+static int inHandler = 0;
+
+
+// Run the interrupt handler for an input edge, if one is attached for it.
+static void fireInterrupt(Board &b, int pin, int level) {
+  void (*handler)(void) = b.handler[pin];
+  int mode = b.handlerMode[pin];
+
+  if (!handler) { return; }
+  if (mode == RISING && level != HIGH) { return; }
+  if (mode == FALLING && level != LOW) { return; }
+  inHandler = 1;
+  handler();
+  inHandler = 0;
+}
+
+
+// Timer1 runs at 80 MHz over the divider.
+static void armTimer(Board &b) {
+  uint64_t divider = b.timerDivider == TIM_DIV16 ? 16 : b.timerDivider == TIM_DIV256 ? 256 : 1;
+  b.timerAt = nowUs + b.timerTicks * divider / 80;
+  b.timerArmed = b.timerEnabled && b.timerHandler;
+}
+
+
+static void fireTimer(Board &b) {
+  if (b.timerReload == TIM_LOOP) { armTimer(b); }
+  else { b.timerArmed = 0; }
+  inHandler = 1;
+  b.timerHandler();
+  inHandler = 0;
+}
+
+
+// The next scripted input or timer1 event of a board, if it has one due by a time.
+static int nextEvent(const Board &b, uint64_t until, uint64_t &at) {
+  if (b.interruptsOff) { return 0; }
+  int haveScript = b.nextScript < b.script.size() && b.script[b.nextScript].at <= until;
+  int haveTimer = b.timerArmed && b.timerAt <= until;
+  if (!haveScript && !haveTimer) { return 0; }
+
+  if (haveTimer && (!haveScript || b.timerAt <= b.script[b.nextScript].at)) { at = b.timerAt; }
+  else { at = b.script[b.nextScript].at; }
+  return 1;
+}
+
+
+static void fireNext(Board &b) {
+  int haveScript = b.nextScript < b.script.size();
+  if (b.timerArmed && (!haveScript || b.timerAt <= b.script[b.nextScript].at)) {
+    if (b.timerAt > nowUs) { nowUs = b.timerAt; }
+    fireTimer(b);
+    return;
+  }
+
+  Edge e = b.script[b.nextScript++];
+  if (e.at > nowUs) { nowUs = e.at; }
+  if (e.pin == A0) { b.analogValue = e.level; }
+  else if (b.level[e.pin] != e.level) {
+    b.level[e.pin] = e.level;
+    fireInterrupt(b, e.pin, e.level);
+  }
+}
+
+
+// Apply scripted input and timer1 up to a time, in time order, on the board that is
+// running and on any attached to the clock. Each event lands at its own time, so a
+// handler it fires sees its exact time on the clock, with hal::board pointing at its
+// own board. With interrupts off they wait, and happen once they are back on.
+static void applyScript(uint64_t until) {
+  for (;;) {
+    Board *due = board;
+    uint64_t dueAt = 0;
+    int have = nextEvent(*board, until, dueAt);
+    for (size_t i = 0; i < attached.size(); i++) {
+      uint64_t at;
+      if (attached[i] == board || !nextEvent(*attached[i], until, at)) { continue; }
+      if (!have || at < dueAt) {
+        due = attached[i];
+        dueAt = at;
+        have = 1;
+      }
+    }
+    if (!have) { break; }
+
+    Board *running = board;
+    board = due;
+    fireNext(*due);
+    board = running;
+  }
+  if (until > nowUs) { nowUs = until; }
+}
+
+
+static void logOutput(Board &b, int pin, int level) {
+  b.log.push_back({ nowUs, pin, level });
+}
+
+
+void reset(Board &b) {
+  for (int i = 0; i < numPins; i++) {
+    b.mode[i] = INPUT;
+    b.level[i] = HIGH;
+    b.handler[i] = 0;
+    b.handlerMode[i] = 0;
+  }
+  b.interruptsOff = 0;
+  b.timerHandler = 0;
+  b.timerEnabled = 0;
+  b.timerDivider = TIM_DIV1;
+  b.timerReload = TIM_SINGLE;
+  b.timerTicks = 0;
+  b.timerArmed = 0;
+  b.timerAt = 0;
+  b.analogValue = 0;
+  b.script.clear();
+  b.nextScript = 0;
+  b.log.clear();
+  memset(b.eeprom, 0xFF, sizeof(b.eeprom));
+  b.eepromSize = 0;
+  b.commits = 0;
+  b.files.clear();
+  b.joinTime = 0;
+  b.joinTimeCached = 0;
+  b.joinedAt = 0;
+  b.joined = 0;
+  b.rxQueue.clear();
+  b.txLog.clear();
+  b.serialEcho = 0;
+  b.serialIn.clear();
+  b.serialOut.clear();
+}
+
+
+void advance(uint32_t us) {
+  // Time spent inside a handler is just cost; script edges wait for it to return.
+  if (inHandler) {
+    nowUs += us;
+    return;
+  }
+  applyScript(nowUs + us);
+}
+
+
+void attach(Board &b) {
+  if (std::find(attached.begin(), attached.end(), &b) == attached.end()) { attached.push_back(&b); }
+}
+
+
+void schedule(Board &b, uint64_t at, int pin, int level) {
+  Edge e = { at, pin, level };
+  // Keep the unplayed part of the script in time order, stable for equal times.
+  std::vector<Edge>::iterator pos = std::upper_bound(b.script.begin() + b.nextScript, b.script.end(), e,
+    [](const Edge &l, const Edge &r) { return l.at < r.at; });
+  b.script.insert(pos, e);
+}
+
+
+void press(Board &b, int pin, uint64_t at, uint64_t duration) {
+  schedule(b, at, pin, LOW);
+  schedule(b, at + duration, pin, HIGH);
+}
+
+
+void scheduleAnalog(Board &b, uint64_t at, int value) {
+  schedule(b, at, A0, value);
+}
+
+
+std::vector<Edge> edges(const Board &b, int pin) {
+  std::vector<Edge> result;
+  for (size_t i = 0; i < b.log.size(); i++) {
+    if (b.log[i].pin == pin) { result.push_back(b.log[i]); }
+  }
+  return result;
+}
+
+}
+
+
+// ARDUINO CORE API
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  hal::board->mode[pin] = mode;
+  if (mode == OUTPUT) { hal::board->level[pin] = LOW; }
+}
+
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  hal::Board &b = *hal::board;
+  int level = val ? HIGH : LOW;
+  if (b.level[pin] != level) {
+    b.level[pin] = level;
+    hal::logOutput(b, pin, level);
+  }
+}
+
+
+int digitalRead(uint8_t pin) {
+  hal::advance(hal::costDigitalRead);
+  return hal::board->level[pin];
+}
+
+
+int analogRead(uint8_t pin) {
+  (void)pin;
+  hal::advance(hal::costAnalogRead);
+  return hal::board->analogValue;
+}
+
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode) {
+  hal::board->handler[pin] = handler;
+  hal::board->handlerMode[pin] = mode;
+}
+
+
+void detachInterrupt(uint8_t pin) {
+  hal::board->handler[pin] = 0;
+}
+
+
+void interrupts() {
+  hal::board->interruptsOff = 0;
+  hal::advance(0);
+}
+
+
+void noInterrupts() {
+  hal::board->interruptsOff = 1;
+}
+
+
+void timer1_attachInterrupt(void (*handler)(void)) {
+  hal::board->timerHandler = handler;
+}
+
+
+void timer1_detachInterrupt() {
+  hal::board->timerHandler = 0;
+  hal::board->timerArmed = 0;
+}
+
+
+void timer1_enable(uint8_t divider, uint8_t type, uint8_t reload) {
+  (void)type;
+  hal::board->timerEnabled = 1;
+  hal::board->timerDivider = divider;
+  hal::board->timerReload = reload;
+}
+
+
+void timer1_disable() {
+  hal::board->timerEnabled = 0;
+  hal::board->timerArmed = 0;
+}
+
+
+// Load the count and start it running down.
+void timer1_write(uint32_t ticks) {
+  hal::board->timerTicks = ticks;
+  hal::armTimer(*hal::board);
+}
+
+
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration) {
+  (void)pin;
+  (void)duration;
+  hal::logOutput(*hal::board, hal::toneChannel, frequency);
+}
+
+
+void noTone(uint8_t pin) {
+  (void)pin;
+  hal::logOutput(*hal::board, hal::toneChannel, 0);
+}
+
+
+unsigned long millis() {
+  hal::advance(hal::costMillis);
+  return (unsigned long)(hal::nowUs / 1000);
+}
+
+
+unsigned long micros() {
+  hal::advance(hal::costMillis);
+  return (unsigned long)hal::nowUs;
+}
+
+
+void delay(unsigned long ms) {
+  hal::advance(ms ? ms * 1000 : hal::costYield);
+}
+
+
+void delayMicroseconds(unsigned int us) {
+  hal::advance(us);
+}
+
+
+void yield() {
+  hal::advance(hal::costYield);
+}
+
+
+uint32_t EspClass::random() const {
+  static uint32_t state = 1;
+  state = state * 1664525 + 1013904223;
+  return state;
+}
+
+
+char *itoa(int value, char *result, int base) {
+  if (base == 16) { sprintf(result, "%x", value); }
+  else { sprintf(result, "%d", value); }
+  return result;
+}
+
+
+// SERIAL
+
+size_t HardwareSerial::print(const char *s) {
+  if (hal::board->serialEcho) { fputs(s, stdout); }
+  return strlen(s);
+}
+
+
+int HardwareSerial::available() { return (int)hal::board->serialIn.size(); }
+
+
+int HardwareSerial::read() {
+  if (hal::board->serialIn.empty()) { return -1; }
+  int b = hal::board->serialIn.front();
+  hal::board->serialIn.pop_front();
+  return b;
+}
+
+
+size_t HardwareSerial::write(uint8_t b) {
+  hal::board->serialOut.push_back(b);
+  return 1;
+}
+
+
+size_t HardwareSerial::print(char c) {
+  char s[2] = { c, 0 };
+  return print(s);
+}
+
+
+size_t HardwareSerial::print(long n, int base) {
+  char s[40];
+  if (base == HEX) { snprintf(s, sizeof(s), "%lX", n); }
+  else if (base == BIN) {
+    int i = 0;
+    unsigned long v = (unsigned long)n;
+    char tmp[40];
+    do { tmp[i++] = '0' + (v & 1); v >>= 1; } while (v);
+    for (int j = 0; j < i; j++) { s[j] = tmp[i - 1 - j]; }
+    s[i] = 0;
+  } else { snprintf(s, sizeof(s), "%ld", n); }
+  return print((const char *)s);
+}
+
+
+size_t HardwareSerial::print(unsigned long n, int base) {
+  if (base == DEC) {
+    char s[24];
+    snprintf(s, sizeof(s), "%lu", n);
+    return print((const char *)s);
+  }
+  return print((long)n, base);
+}
+
+
+size_t HardwareSerial::print(int n, int base) { return print((long)n, base); }
+size_t HardwareSerial::print(unsigned int n, int base) { return print((unsigned long)n, base); }
+
+
+size_t HardwareSerial::print(double n, int digits) {
+  char s[40];
+  snprintf(s, sizeof(s), "%.*f", digits, n);
+  return print((const char *)s);
+}
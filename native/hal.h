@@ -0,0 +1,107 @@
+// Native hardware abstraction layer.
+
+// Stands in for the ESP8266 Arduino core when the keyer is built with the
+// native environment. Time is a virtual clock in microseconds: every HAL call
+// costs a small fixed amount of time, and delay() jumps the clock forward,
+// so a run is deterministic and takes a tiny fraction of real time.
+// Paddle and switch input is scripted as timed pin events, and every change
+// on an output pin (key line, LED, sidetone) is logged with its timestamp.
+// An input edge fires its attached interrupt handler at the scripted time,
+// even in the middle of a delay(), and so does timer1 when it runs out.
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace hal {
+
+const int numPins = 18;                   // GPIO0-16 plus the A0 pseudo pin
+const int toneChannel = numPins;          // Tone changes are logged against this pin
+
+// Virtual CPU cost of the HAL calls, in microseconds.
+const uint32_t costMillis = 1;
+const uint32_t costDigitalRead = 1;
+const uint32_t costAnalogRead = 100;
+const uint32_t costYield = 5;
+
+struct Edge {
+  uint64_t at;                            // in micro time
+  int pin;
+  int level;                              // pin level, or tone frequency on toneChannel
+};
+
+struct Board {
+  int mode[numPins];
+  int level[numPins];
+  int analogValue;
+
+  void (*handler[numPins])(void);        // attached interrupt handlers
+  int handlerMode[numPins];
+  int interruptsOff;                      // handlers wait for interrupts()
+
+  void (*timerHandler)(void);             // timer1
+  int timerEnabled;
+  int timerDivider;
+  int timerReload;
+  uint32_t timerTicks;
+  int timerArmed;
+  uint64_t timerAt;
+
+  std::vector<Edge> script;               // scripted input, sorted by time
+  size_t nextScript;
+  std::vector<Edge> log;                  // output changes
+
+  uint8_t eeprom[4096];
+  size_t eepromSize;
+  unsigned int commits;
+
+  std::map< std::string, std::vector<uint8_t> > files;   // LittleFS contents
+
+  uint64_t joinTime;                      // WiFi association time, scanning for the AP
+  uint64_t joinTimeCached;                // and with its BSSID and channel given
+  uint64_t joinedAt;                      // when WiFi.status() turns connected
+  int joined;                             // WiFi.begin() was called
+
+  std::deque< std::vector<uint8_t> > rxQueue;
+  std::vector< std::vector<uint8_t> > txLog;
+
+  int serialEcho;
+  std::deque<uint8_t> serialIn;           // bytes for Serial.read()
+  std::vector<uint8_t> serialOut;         // bytes from Serial.write()
+};
+
+extern uint64_t nowUs;
+extern Board *board;
+
+// Clear a board to its power-on state: inputs pulled up, blank flash.
+void reset(Board &b);
+
+// Move the virtual clock forward and apply any scripted input that is due.
+void advance(uint32_t us);
+
+// Run a board on the shared clock alongside whichever one hal::board points at: its
+// scripted input and timer1 fire as time passes, whichever board's code is running.
+// For simulating more than one keyer at once (see native/netsim).
+void attach(Board &b);
+
+// Script an input level change at an absolute virtual time.
+void schedule(Board &b, uint64_t at, int pin, int level);
+
+// Script a press (pull LOW) of an input pin for a duration.
+void press(Board &b, int pin, uint64_t at, uint64_t duration);
+
+// Script an analog value on A0 from a given time.
+void scheduleAnalog(Board &b, uint64_t at, int value);
+
+// Edges logged for one output pin, in time order.
+std::vector<Edge> edges(const Board &b, int pin);
+
+}
+
+#endif
@@ -0,0 +1,87 @@
+// Emulated UDP link for the netsim harness.
+
+// Carries the datagrams one board sends to another: each arrives after a base
+// delay plus a random jitter, and at set rates one is lost, arrives twice, or
+// is held back to arrive just after the one sent next. Random numbers come
+// from the link's own seeded generator, so a run repeats exactly.
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <algorithm>
+#include <vector>
+#include <hal.h>
+
+class Link {
+public:
+  Link(uint32_t delayUs, uint32_t jitterUs, int lossPercent, int duplicatePercent, int reorderPercent, uint32_t seed)
+    : sent(0), lost(0), duplicated(0), reordered(0), delayUs(delayUs), jitterUs(jitterUs),
+      lossPercent(lossPercent), duplicatePercent(duplicatePercent), reorderPercent(reorderPercent),
+      state(seed), taken(0), holding(-1) {}
+
+  // Take what a board has sent since the last call.
+  void carry(const hal::Board &from) {
+    while (taken < from.txLog.size()) {
+      const std::vector<uint8_t> &data = from.txLog[taken++];
+      sent++;
+      if (chance(lossPercent)) {
+        lost++;
+        continue;
+      }
+      uint64_t at = hal::nowUs + delayUs + (jitterUs ? random() % jitterUs : 0);
+      if (holding >= 0) {                                 // The one held back follows this one
+        flight[holding].at = at + 1;
+        holding = -1;
+      }
+      flight.push_back({ at, data });
+      if (chance(reorderPercent)) {
+        reordered++;
+        flight.back().at = UINT64_MAX;
+        holding = flight.size() - 1;
+      }
+      if (chance(duplicatePercent)) {
+        duplicated++;
+        flight.push_back({ at + (jitterUs ? random() % jitterUs : 0) + 1, data });
+      }
+    }
+  }
+
+  // Hand on the datagrams that have arrived by now, in the order they arrived.
+  void deliver(hal::Board &to) {
+    std::stable_sort(flight.begin(), flight.end(), [](const InFlight &l, const InFlight &r) { return l.at < r.at; });
+    size_t n = 0;
+    while (n < flight.size() && flight[n].at <= hal::nowUs) { to.rxQueue.push_back(flight[n++].data); }
+    flight.erase(flight.begin(), flight.begin() + n);
+    if (holding >= 0) { holding = flight.size() - 1; }   // Sorted last, as it has no time yet
+  }
+
+  unsigned long sent;
+  unsigned long lost;
+  unsigned long duplicated;
+  unsigned long reordered;
+
+private:
+  struct InFlight {
+    uint64_t at;                          // arrival, in micro time
+    std::vector<uint8_t> data;
+  };
+
+  uint32_t random() {
+    state = state * 1103515245 + 12345;
+    return (state >> 8) & 0xFFFFFF;
+  }
+
+  int chance(int percent) { return percent > 0 && (int) (random() % 100) < percent; }
+
+  uint32_t delayUs;
+  uint32_t jitterUs;
+  int lossPercent;
+  int duplicatePercent;
+  int reorderPercent;
+  uint32_t state;
+  size_t taken;                           // datagrams taken from the sender's log
+  long holding;                           // index of the datagram held back, -1 for none
+  std::vector<InFlight> flight;
+};
+
+#endif
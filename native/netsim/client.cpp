@@ -0,0 +1,8 @@
+// The keyer built as the client, in namespace client.
+
+#include "prelude.h"
+
+#define CLIENT
+namespace client {
+#include "../../src/keyer.cpp"
+}
@@ -0,0 +1,239 @@
+// Client and server keyer pair on one virtual clock.
+
+// Runs the keyer twice in one process, as the client and as the server, each
+// on a board of its own, joined by an emulated UDP link each way (Link.h).
+// The text is keyed into the client's paddles at the given speed, element by
+// element as an operator would, and the server's key line is decoded back to
+// text. It prints both, and how the server's marks and spaces compare with
+// the client's: latency, mark and space error, and the link and playout
+// counts. The exit status is 1 if the server sent anything other than what
+// the client keyed, so a run can go in a regression script.
+//
+// Usage: netsim [-d delay ms] [-j jitter ms] [-l loss %] [-u duplicate %]
+//               [-r reorder %] [-s seed] [-w wpm] [-k] [-b] [-v] [text]
+// -k keys the text on a straight key, by the dit paddle, instead of iambic.
+// -b keys the first word, boots the client again, and keys the text on the
+//    new boot, which numbers its frames from 1 again.
+// -v lists both key lines edge by edge.
+
+#include "prelude.h"
+#include <hal.h>
+#include <string>
+#include "Link.h"
+
+namespace client {
+void setup();
+void loop();
+extern KeyTiming timing;
+extern int currKeyerMode;
+}
+
+namespace rebooted {
+void setup();
+void loop();
+extern KeyTiming timing;
+extern int currKeyerMode;
+}
+
+namespace server {
+void setup();
+void loop();
+extern unsigned long playoutSlips;
+extern unsigned long playoutDrops;
+}
+
+// Pin assignments from keyer.cpp (those are const, so not linkable).
+const int pinKeyDit = D5;
+const int pinKeyDah = D6;
+const int pinMosfet = D0;
+const int modeStraight = 2;               // keyerModeStraight
+
+const uint64_t settleUs = 3000000;        // Boot, join and the first clock syncs
+const uint64_t drainUs = 3000000;         // Left for the server to play out
+
+
+struct Mark {
+  uint64_t down;
+  uint64_t up;
+};
+
+
+struct Stats {
+  unsigned long count;
+  double sum;
+  double worst;
+
+  void add(double v) {
+    count++;
+    sum += v;
+    if (fabs(v) > fabs(worst)) { worst = v; }
+  }
+  double mean() const { return count ? sum / count : 0; }
+};
+
+
+static hal::Board clientBoard;
+static hal::Board serverBoard;
+static void (*clientLoop)() = client::loop;  // rebooted::loop once the client boots again
+
+
+// Script the paddle presses for the text, from a time. Returns when the last element ends.
+static uint64_t keyText(const char *text, uint64_t at, uint64_t unit, int straight) {
+  for (const char *p = text; *p; p++) {
+    if (*p == ' ') {
+      at += unit * 4;
+      continue;
+    }
+    const MorseCode &code = morseTable[*p];
+    for (int i = 0; i < code.length; i++) {
+      int dah = morseElementAt(code, i);
+      uint64_t mark = unit * (dah ? 3 : 1);
+      if (straight) { hal::press(clientBoard, pinKeyDit, at, mark); }
+      else { hal::press(clientBoard, dah ? pinKeyDah : pinKeyDit, at, unit / 2); }
+      at += mark + unit;
+    }
+    at += unit * 2;
+  }
+  return at;
+}
+
+
+// The marks on a board's key line from a time.
+static std::vector<Mark> marks(const hal::Board &b, uint64_t from) {
+  std::vector<Mark> result;
+  for (const hal::Edge &e : hal::edges(b, pinMosfet)) {
+    if (e.at < from) { continue; }
+    if (e.level == HIGH) { result.push_back({ e.at, 0 }); }
+    else if (!result.empty() && !result.back().up) { result.back().up = e.at; }
+  }
+  return result;
+}
+
+
+// Read marks back as text: a mark of two units or more is a dah, a space of two units or
+// more ends a character, and one of five or more a word.
+static std::string decode(const std::vector<Mark> &line, uint64_t unit) {
+  std::string text;
+  MorseCode code = { 0, 0, 0 };
+
+  for (size_t i = 0; i < line.size(); i++) {
+    code = morseMerge(code, morseTable[line[i].up - line[i].down >= 2 * unit ? 'T' : 'E']);
+    uint64_t space = (i + 1 < line.size()) ? line[i + 1].down - line[i].up : UINT64_MAX;
+    if (space < 2 * unit) { continue; }
+    char c = morseDecode(code);
+    text += c ? c : '*';
+    if (space >= 5 * unit && i + 1 < line.size()) { text += ' '; }
+    code = MorseCode { 0, 0, 0 };
+  }
+  return text;
+}
+
+
+// Run both keyers and the links between them up to a time.
+static void run(uint64_t until, Link &up, Link &down) {
+  while (hal::nowUs < until) {
+    hal::board = &clientBoard;
+    clientLoop();
+    up.carry(clientBoard);
+    down.deliver(clientBoard);
+    hal::board = &serverBoard;
+    server::loop();
+    down.carry(serverBoard);
+    up.deliver(serverBoard);
+  }
+}
+
+
+static void printLine(const char *name, const std::vector<Mark> &line, uint64_t from) {
+  printf("%s:", name);
+  for (const Mark &m : line) { printf(" %.1f-%.1f", (m.down - from) / 1000.0, (m.up - from) / 1000.0); }
+  printf("\n");
+}
+
+
+int main(int argc, char **argv) {
+  double delay = 20, jitter = 10;
+  int loss = 0, duplicate = 0, reorder = 0, wpm = 20, straight = 0, reboot = 0, verbose = 0;
+  uint32_t seed = 1;
+  const char *text = "PARIS PARIS CQ CQ DE K1BR K1BR K";
+
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    int more = i + 1 < argc;
+    if (a == "-d" && more) { delay = atof(argv[++i]); }
+    else if (a == "-j" && more) { jitter = atof(argv[++i]); }
+    else if (a == "-l" && more) { loss = atoi(argv[++i]); }
+    else if (a == "-u" && more) { duplicate = atoi(argv[++i]); }
+    else if (a == "-r" && more) { reorder = atoi(argv[++i]); }
+    else if (a == "-s" && more) { seed = strtoul(argv[++i], NULL, 10); }
+    else if (a == "-w" && more) { wpm = atoi(argv[++i]); }
+    else if (a == "-k") { straight = 1; }
+    else if (a == "-b") { reboot = 1; }
+    else if (a == "-v") { verbose = 1; }
+    else { text = argv[i]; }
+  }
+
+  Link up(delay * 1000, jitter * 1000, loss, duplicate, reorder, seed);
+  Link down(delay * 1000, jitter * 1000, loss, duplicate, reorder, seed * 7919);
+
+  hal::reset(clientBoard);
+  hal::reset(serverBoard);
+  hal::attach(clientBoard);
+  hal::attach(serverBoard);
+  hal::board = &clientBoard;
+  client::setup();
+  hal::board = &serverBoard;
+  server::setup();
+
+  client::timing.setSpeed(wpm * 10);
+  if (straight) { client::currKeyerMode = modeStraight; }
+  uint64_t unit = client::timing.unit();
+
+  // The first word goes out on the first boot, so the server's receive window is a few
+  // dozen frames on when the client starts its count over.
+  if (reboot) {
+    std::string word(text, strcspn(text, " "));
+    run(keyText(word.c_str(), hal::nowUs + settleUs, unit, straight) + drainUs, up, down);
+    hal::board = &clientBoard;
+    rebooted::setup();
+    clientLoop = rebooted::loop;
+    rebooted::timing.setSpeed(wpm * 10);
+    if (straight) { rebooted::currKeyerMode = modeStraight; }
+  }
+
+  uint64_t start = hal::nowUs + settleUs;
+  uint64_t end = keyText(text, start, unit, straight) + drainUs;
+
+  run(end, up, down);
+
+  std::vector<Mark> keyed = marks(clientBoard, start);
+  std::vector<Mark> played = marks(serverBoard, start);
+  std::string keyedText = decode(keyed, unit);
+  std::string playedText = decode(played, unit);
+
+  Stats latency = {}, mark = {}, space = {};
+  for (size_t i = 0; i < keyed.size() && i < played.size(); i++) {
+    latency.add(((int64_t) played[i].down - (int64_t) keyed[i].down) / 1000.0);
+    mark.add(((int64_t) (played[i].up - played[i].down) - (int64_t) (keyed[i].up - keyed[i].down)) / 1000.0);
+    if (i + 1 < keyed.size() && i + 1 < played.size()) {
+      space.add(((int64_t) (played[i + 1].down - played[i].up) - (int64_t) (keyed[i + 1].down - keyed[i].up)) / 1000.0);
+    }
+  }
+
+  printf("sent:     %s\n", text);
+  printf("keyed:    %s\n", keyedText.c_str());
+  printf("received: %s\n", playedText.c_str());
+  if (verbose) {
+    printLine("client", keyed, start);
+    printLine("server", played, start);
+  }
+  printf("marks %zu keyed, %zu received\n", keyed.size(), played.size());
+  printf("latency ms    %8.3f mean %8.3f worst\n", latency.mean(), latency.worst);
+  printf("mark err ms   %8.3f mean %8.3f worst\n", mark.mean(), mark.worst);
+  printf("space err ms  %8.3f mean %8.3f worst\n", space.mean(), space.worst);
+  printf("link up   %lu sent %lu lost %lu duplicated %lu reordered\n", up.sent, up.lost, up.duplicated, up.reordered);
+  printf("link down %lu sent %lu lost %lu duplicated %lu reordered\n", down.sent, down.lost, down.duplicated, down.reordered);
+  printf("playout slips %lu drops %lu\n", server::playoutSlips, server::playoutDrops);
+
+  return playedText == keyedText ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+// Everything keyer.cpp includes, at global scope.
+
+// The netsim build compiles keyer.cpp twice, once as the client and once as
+// the server, each inside a namespace of its own so the two keep separate
+// globals. Including this first means the headers are already in when
+// keyer.cpp includes them again inside the namespace, so only the keyer's own
+// code ends up in it, and both instances share the one HAL.
+
+#ifndef NETSIM_PRELUDE_H
+#define NETSIM_PRELUDE_H
+
+#include <Arduino.h>
+#include <EEPROM_Rotate.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <LittleFS.h>
+#include <CircularBuffer.h>
+#include <JitterBuffer.h>
+#include <ClockSync.h>
+#include <WireFormat.h>
+#include <ReceiveWindow.h>
+#include <EventQueue.h>
+#include <Debouncer.h>
+#include <MorseTable.h>
+#include <MemoryBank.h>
+#include <WinKeyer.h>
+#include <Telemetry.h>
+#include <Monitor.h>
+#include <DatagramQueue.h>
+#include <Timing.h>
+
+#endif
@@ -0,0 +1,11 @@
+// The keyer built as the client again, in namespace rebooted, for netsim -b.
+
+// A second instance starts with its globals fresh, as the client does when it
+// boots again, on the client's board, so storage and the link carry over.
+
+#include "prelude.h"
+
+#define CLIENT
+namespace rebooted {
+#include "../../src/keyer.cpp"
+}
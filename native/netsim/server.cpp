@@ -0,0 +1,8 @@
+// The keyer built as the server, in namespace server.
+
+#include "prelude.h"
+
+#define SERVER 1
+namespace server {
+#include "../../src/keyer.cpp"
+}
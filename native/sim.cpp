@@ -0,0 +1,134 @@
+// Native keyer timing simulator.
+
+// Boots the keyer on the virtual clock, then presses the paddles in scripted
+// patterns at a range of speeds and measures the resulting key line:
+// element-length error against the nominal dit/dah/space, and latency from
+// paddle press to key-down. Each run starts at a different phase so the
+// loop granularity shows up in the spread.
+//
+// Usage: sim [runs per speed] [wpm ...]
+
+#include <Arduino.h>
+#include <hal.h>
+#include <Timing.h>
+
+extern KeyTiming timing;
+void setup();
+void loop();
+
+// Pin assignments from keyer.cpp (those are const, so not linkable).
+const int pinKeyDit = D5;
+const int pinKeyDah = D6;
+const int pinMosfet = D0;
+
+
+struct Stats {
+  unsigned long count;
+  double sum;
+  double worst;
+
+  void add(double v) {
+    count++;
+    sum += v;
+    if (fabs(v) > fabs(worst)) { worst = v; }
+  }
+  double mean() const { return count ? sum / count : 0; }
+};
+
+
+static uint32_t lcgState = 12345;
+
+static uint32_t lcg() {
+  lcgState = lcgState * 1103515245 + 12345;
+  return (lcgState >> 8) & 0xFFFFFF;
+}
+
+
+// Run the keyer loop until the virtual clock reaches a time.
+static void runUntil(uint64_t until) {
+  while (hal::nowUs < until) { loop(); }
+}
+
+
+// Measure the key line edges logged since a given index.
+static void measure(size_t from, uint64_t pressedAt, Stats &dit, Stats &dah, Stats &space, Stats &latency) {
+  double unit = timing.unit();
+  uint64_t downAt = 0;
+  uint64_t upAt = 0;
+  int first = 1;
+
+  for (size_t i = from; i < hal::board->log.size(); i++) {
+    const hal::Edge &e = hal::board->log[i];
+    if (e.pin != pinMosfet) { continue; }
+    if (e.level == HIGH) {
+      if (first) {
+        latency.add((e.at - pressedAt) / 1000.0);
+        first = 0;
+      } else if (e.at - upAt < 2 * unit) {
+        space.add((e.at - upAt - unit) / 1000.0);
+      }
+      downAt = e.at;
+    } else {
+      double length = e.at - downAt;
+      if (length < 2 * unit) { dit.add((length - unit) / 1000.0); }
+      else { dah.add((length - 3 * unit) / 1000.0); }
+      upAt = e.at;
+    }
+  }
+}
+
+
+int main(int argc, char **argv) {
+  int runs = 200;
+  std::vector<int> speeds;
+
+  if (argc > 1) { runs = atoi(argv[1]); }
+  for (int i = 2; i < argc; i++) { speeds.push_back(atoi(argv[i])); }
+  if (speeds.empty()) { speeds = { 15, 20, 25, 30, 35, 40 }; }
+
+  hal::reset(*hal::board);
+  setup();
+  runUntil(hal::nowUs + 3000000);         // Let the boot announcement finish
+
+  printf("%4s %6s %16s %16s %16s %16s\n", "WPM", "elems", "dit err ms", "dah err ms", "space err ms", "latency ms");
+  printf("%4s %6s %16s %16s %16s %16s\n", "", "", "mean / worst", "mean / worst", "mean / worst", "mean / worst");
+
+  for (size_t s = 0; s < speeds.size(); s++) {
+    Stats dit = {}, dah = {}, space = {}, latency = {};
+    timing.setSpeed(speeds[s] * 10);
+    uint64_t unit = timing.unit();
+
+    for (int r = 0; r < runs; r++) {
+      size_t from = hal::board->log.size();
+      uint64_t pressedAt = hal::nowUs + unit * 2 + lcg() % unit;
+      uint64_t held = unit * 6 + lcg() % unit;
+
+      // Alternate dit runs, dah runs, squeezes, and dah runs with a dit tap
+      // much shorter than an element, which must still be inserted.
+      switch (r % 4) {
+        case 0:
+          hal::press(*hal::board, pinKeyDit, pressedAt, held);
+          break;
+        case 1:
+          hal::press(*hal::board, pinKeyDah, pressedAt, held);
+          break;
+        case 2:
+          hal::press(*hal::board, pinKeyDit, pressedAt, held);
+          hal::press(*hal::board, pinKeyDah, pressedAt, held);
+          break;
+        default:
+          hal::press(*hal::board, pinKeyDah, pressedAt, held);
+          hal::press(*hal::board, pinKeyDit, pressedAt + unit, 4000);
+      }
+      runUntil(pressedAt + held + unit * 10);
+      measure(from, pressedAt, dit, dah, space, latency);
+    }
+
+    printf("%4d %6lu %7.3f / %6.3f %7.3f / %6.3f %7.3f / %6.3f %7.3f / %6.3f\n",
+      speeds[s], dit.count + dah.count,
+      dit.mean(), dit.worst, dah.mean(), dah.worst,
+      space.mean(), space.worst, latency.mean(), latency.worst);
+  }
+
+  return 0;
+}
@@ -27,9 +27,13 @@
 // 3: Switch to vibroplex by pressing Memory3.
 
 // Notes on networking:
-// There is a 2 char delay on the server side to allow buffering. Inter-character timimg is preserved.
-// Networking only functions in iambic mode.
-// If you try to send a string of elements longer than 8, a packet will be sent, causing a slight pause in the sidetone.
+// With streamElements set in Network.h, each element is sent as it starts, and the server
+// keys it after a fixed playout delay (playoutDelay).
+// Otherwise whole characters are sent, and the server buffers them by an adaptive playout delay
+// sized from the measured jitter. Inter-character timimg is preserved.
+// In straight key and vibroplex modes, key edges are streamed with their timing instead.
+// Frames are variable length (see WireFormat.h), so a run of any length up to 128 elements goes out in one.
+// Memories and host messages are sent as text, and the server keys them at its own exact timing.
 
 // 2022-05-22 - Translate comments and configure for Platformio. Add inital Iambic Mode B code.
 // 2022-05-23 - Move memory switches to A0.
@@ -40,6 +44,32 @@
 // 2022-06-12 - Fix memory and network playback timings.
 // 2022-06-14 - Add EEPROM-rotate library, fix paddle debounce, add speed annoucements.
 // 2022-06-16 - Update eeprom rotation reserved memory.
+// 2026-10-16 - Add native build target with stubbed HAL and virtual clock.
+// 2026-10-16 - Non-blocking keyer engine, paddles no longer block loop().
+// 2026-10-16 - Element streaming mode for low latency remote keying.
+// 2026-10-16 - Adaptive jitter buffer replaces the fixed 2 packet server buffer.
+// 2026-10-16 - Clock sync over keepalive, frames carry server time once synced.
+// 2026-10-16 - Variable length wire format, no more 8 element limit.
+// 2026-10-16 - Forward error correction, frames carry copies of the ones before.
+// 2026-10-16 - Server receive window: reorder, drop duplicates, count losses, late frame policy.
+// 2026-10-16 - Paddles on edge interrupts with integrator debounce, no more polling delay.
+// 2026-10-16 - Key line, LED and sidetone driven from timer1, elements timed in micros.
+// 2026-10-16 - Remote straight key and vibroplex, by streaming key edges.
+// 2026-10-16 - Morse table built at compile time, full ITU set and prosigns.
+// 2026-10-16 - Settings written back from RAM in one commit, storage records carry a CRC.
+// 2026-10-16 - Fast boot: WiFi joins in the background from a cached access point, announcements from loop().
+// 2026-10-16 - Memories moved to LittleFS, 30 slots in pages of three, streamed through a double buffer.
+// 2026-10-16 - WinKeyer 2 host interface with a type-ahead buffer, text keyed from loop().
+// 2026-10-16 - Memories and host messages go to the server as text frames, not keyed elements.
+// 2026-10-16 - Link telemetry: counters and histograms sent to a collector as a stats datagram.
+// 2026-10-16 - A press that breaks in on the announcement or host text no longer plays twice.
+// 2026-10-16 - Squeezes: no stale extra element, mode B completes after a dit. Exact player spacing.
+// 2026-10-16 - Monitor fan-out: the server sends on what it keys to subscribed or multicast listeners.
+// 2026-10-16 - Echo: the server reports the marks it keyed, the client measures the round trip.
+// 2026-10-16 - Datagrams to the peer are queued and sent from loop(), nothing waits on a send.
+// 2026-10-16 - Every datagram waiting is read each pass, up to receiveBatch, not one a pass.
+// 2026-10-16 - Timing table in micros from a real WPM, with weighting, ratio and Farnsworth.
+// 2026-10-16 - Memories, recording, setting modes and prompts run from loop(), none of them block it.
 
 
 #include <Arduino.h>
@@ -47,56 +77,34 @@
 #include <ESP8266WiFi.h>
 #include <WiFiUdp.h>
 #include <CircularBuffer.h>
+#include <JitterBuffer.h>
+#include <ClockSync.h>
+#include <WireFormat.h>
+#include <ReceiveWindow.h>
+#include <EventQueue.h>
+#include <Debouncer.h>
+#include <MorseTable.h>
+#include <MemoryBank.h>
+#include <WinKeyer.h>
+#include <Telemetry.h>
+#include <Monitor.h>
+#include <DatagramQueue.h>
+#include <Timing.h>
 
 #define DEBUG_PIN
 // #define DEBUG
+// #define WINKEYER                     // WinKeyer host interface on the serial port, at 1200 baud,
+                                        // or -D WINKEYER in build_flags. Set monitor_speed to 1200 to
+                                        // match; the port then carries no text or debug output.
+#ifdef WINKEYER
+#undef DEBUG
+#endif
 
 #include <Pinflip.h>
 #include <Debug.h>
 
 #define SPKR 0
 #define TX 1
-#define NO_REC 0
-#define REC 1
-#define MORSE_NONE 0x01
-
-
-// Morse encoding derived from KB8OJH
-// https://kb8ojh.net/msp430/
-const unsigned char morse_ascii[] = {
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  0x73, MORSE_NONE, 0x55, 0x32,                   /* , _ . / */
-  0x3F, 0x2F, 0x27, 0x23,                         /* 0 1 2 3 */
-  0x21, 0x20, 0x30, 0x38,                         /* 4 5 6 7 */
-  0x3C, 0x3E, MORSE_NONE, MORSE_NONE,             /* 8 9 _ _ */
-  MORSE_NONE, 0x31, MORSE_NONE, 0x4C,             /* _ = _ ? */
-  MORSE_NONE, 0x05, 0x18, 0x1A,                   /* _ A B C */
-  0x0C, 0x02, 0x12, 0x0E,                         /* D E F G */
-  0x10, 0x04, 0x17, 0x0D,                         /* H I J K */
-  0x14, 0x07, 0x06, 0x0F,                         /* L M N O */
-  0x16, 0x1D, 0x0A, 0x08,                         /* P Q R S */
-  0x03, 0x09, 0x11, 0x0B,                         /* T U V W */
-  0x19, 0x1B, 0x1C, MORSE_NONE,                   /* X Y Z _ */
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-  MORSE_NONE, 0x05, 0x18, 0x1A,                   /* _ A B C */
-  0x0C, 0x02, 0x12, 0x0E,                         /* D E F G */
-  0x10, 0x04, 0x17, 0x0D,                         /* H I J K */
-  0x14, 0x07, 0x06, 0x0F,                         /* L M N O */
-  0x16, 0x1D, 0x0A, 0x08,                         /* P Q R S */
-  0x03, 0x09, 0x11, 0x0B,                         /* T U V W */
-  0x19, 0x1B, 0x1C, MORSE_NONE,                   /* X Y Z _ */
-  MORSE_NONE, MORSE_NONE, MORSE_NONE, MORSE_NONE,
-};
 
 
 // PINS
@@ -114,6 +122,8 @@ const int pinSpeaker = D8;             // Speaker
 const int stateIdle = 0;
 const int stateSettingSpeed = 1;
 const int stateSettingTone = 2;
+const int stateRecording = 3;
+const int stateSettingPage = 4;
 
 
 // MODE TYPES
@@ -122,10 +132,18 @@ const int keyerModeIambic = 0;
 const int keyerModeVibroplex = 1;
 const int keyerModeStraight = 2;
 
+const int keyerIdle = 0;
+const int keyerMark = 1;
+const int keyerSpace = 2;
+
 const int netDisconnected = 0;
 const int netClient = 1;
 const int netServer = 2;
 
+const int linkDown = 0;                 // WiFi not started
+const int linkJoining = 1;              // Associating in the background
+const int linkUp = 2;
+
 
 // SYMBOLS
 
@@ -133,6 +151,15 @@ const int symDit = 1;
 const int symDah = 2;
 
 
+// OUTPUT EDGES
+
+const uint8_t outKeyLines = 1;          // Edge sets the LED and rig lines
+const uint8_t outLed = 2;
+const uint8_t outRig = 4;
+const uint8_t outSound = 8;             // Edge sets the sidetone
+const uint32_t outTicksPerMicro = 5;    // timer1 at 80 MHz / 16
+
+
 // SAVE PACKET TYPES
 
 const int packetTypeEnd = 0;
@@ -141,47 +168,168 @@ const int packetTypeFreq = 2;
 const int packetTypeKeyerModeIambic = 3;
 const int packetTypeKeyerModeVibroplex = 4;
 const int packetTypeKeyerModeStraight = 5;
+const int packetTypeWifi = 6;
+const int packetTypeWpm = 7;            // Speed in tenths of WPM; packetTypeSpeed held the dit in millis
+const int packetTypePage = 8;           // Memory page
 const int packetTypeMem0 = 20;
 const int packetTypeMem1 = 21;
 const int packetTypeMem2 = 22;
 
 
-// UDP PACKET TYPES
+// INTERNAL MEMORIES
 
-const int udpFrame = 0;
-const int udpKeepAlive = 2;
-const int udpAck = 3;
+const int storageSize = 1024;
+const int storageMagic1 = 182;
+const int storageMagic2 = 98;             // 98: records carry a length and a CRC
+const int storageMagicBare = 97;          // 97: bare records, as written before
+const int memoryWordCode = 14;            // Recorded space from which a memory is read as a word space
+const int memoryButtons = 3;              // Memory switches: the slots of a page
+const int memoryPages = memoryBankSlots / memoryButtons;
+const int memoryNone = -2;                // No code held back from the memory text
+const unsigned long switchDebounce = 50;  // Least millis between changes of the Setup button
+const unsigned long switchLong = 1000;    // Millis a switch is held for a long press
 
 
-// INTERNAL MEMORIES
+// SETTINGS, flags for the write-back cache
 
-const int storageSize = 2048;
-const int storageMagic1 = 182;
-const int storageMagic2 = 97;
+const uint8_t settingSpeed = 0x01;
+const uint8_t settingFreq = 0x02;
+const uint8_t settingMode = 0x04;
+const uint8_t settingWifi = 0x08;
+const uint8_t settingPage = 0x10;
 
 
 // CONFIG DEFAULTS
 
 int toneFreq = 700;                     // Default sidetone frequncy
-unsigned int ditMillis = 60;            // Default speed (20 WPM)
+KeyTiming timing(200);                  // Default speed, in tenths of WPM (20 WPM)
 int currKeyerMode = keyerModeIambic;    // Default mode
 int iambicModeB = 1;                    // Default iambic mode
+const uint32_t paddleDebounce = 1500;   // Paddle debounce integrator, in micros
+const unsigned long switchPoll = 3;     // Least millis between reads of the A0 switches
+const uint32_t keyerLead = 1000;        // Micros before a space ends that the next element is queued
+const uint32_t edgeMaxSpan = 100000;    // Longest silence sent before a key edge, in wireEdgeUnit
+const unsigned long settingsIdle = 2000; // Millis a changed setting is left before it is written
+
+MemoryBank memories;
+
+struct WifiCache {
+  uint8_t bssid[6];                     // Access point last associated with
+  uint8_t channel;
+  uint8_t ip[4];                        // and the address DHCP gave
+  uint8_t gateway[4];
+  uint8_t subnet[4];
+};
 
-char memory[3][600];
-size_t memorySize[3];
+WifiCache wifiCache;
+int wifiCached = 0;                     // wifiCache was loaded or learned
 
 EEPROM_Rotate EEPROMr;
 
+struct PaddleEdge {
+  uint32_t at;                          // in micro time
+  uint8_t pin;
+  uint8_t closed;
+};
+
+EventQueue < PaddleEdge, 32> paddleEdges;
+
+struct OutputEdge {
+  uint32_t at;                          // in micro time
+  uint16_t tone;                        // sidetone frequency, 0 for silence
+  uint8_t what;                         // outKeyLines, outLed, outRig, outSound
+  uint8_t epoch;
+};
+
+EventQueue < OutputEdge, 16> outputEdges;
+Debouncer ditPaddle(paddleDebounce);
+Debouncer dahPaddle(paddleDebounce);
+
 // See the Network.h file in the include subdirectory to configure the network.
 #include <Network.h>
 
 WiFiUDP udp;
-struct DataPacket {
-  unsigned int number;
-  unsigned int data;
+struct PlayoutElement {
+  unsigned long at;                       // local playout time in millis
+  int sym;
+  WireTiming timing;                      // the sender's
+};
+
+CircularBuffer < PlayoutElement, 32> elements;
+
+struct PlayoutEdge {
+  uint32_t at;                            // local playout time in micros
+  int down;
+};
+
+CircularBuffer < PlayoutEdge, 32> keyEdges;
+
+struct PlayoutChar {
+  unsigned long at;                       // local playout time in millis, for the first of a frame
+  WireTiming timing;                      // the sender's
+  char c;
+  uint8_t first;                          // first character of its frame
+};
+
+CircularBuffer < PlayoutChar, 64> remoteText;
+JitterBuffer jitter(jitterPercentile, minPlayoutDelay, maxPlayoutDelay, playoutDelay);
+ClockSync clockSync;
+struct ReceivedFrame {
+  WireFrame frame;
+  unsigned long arrival;                  // millis when its datagram came in
+  int recovered;                          // came as a copy in a later datagram
+};
+
+ReceiveWindow < ReceivedFrame, 8> peerFrames;
+Telemetry stats;
+Monitor monitor;
+DatagramQueue < 8> outgoing;              // Datagrams to the peer, sent one a pass from loop()
+
+struct SentFrame {
+  unsigned long at;                       // millis when first sent
+  uint8_t size;
+  uint8_t bytes[wireMaxSize];
+};
+
+SentFrame sentFrames[wireMaxRedundancy];  // Recent frames, resent for error correction
+int sentNext = 0;
+int repeatsPending = 0;                   // Repeats still to send after the last frame
+int repeatHeld = 0;                       // Straight key held down: repeat until the key-up
+unsigned long repeatAt = 0;               // when the last frame or repeat went
+
+struct SentMark {
+  unsigned long down;                     // millis of the key-down
+  uint32_t mark;                          // in micros
 };
 
-CircularBuffer < DataPacket, 10> packets;
+CircularBuffer < SentMark, 16> sentMarks; // Client: marks keyed, waiting for their echo
+WireFrame echoFrame;                      // Server: marks keyed, waiting to be echoed
+
+struct CharSender {
+  MorseCode code;                         // Character being sent
+  int element;                            // its next element
+  uint32_t gap;                           // micros of space to add after it
+  int busy;
+  uint32_t at;                            // when the next element is due, in micro time
+  int transmit;
+};
+
+struct Beep {
+  uint16_t tone;                          // 0 for silence
+  uint8_t led;
+  uint16_t length;                        // in millis
+};
+
+CharSender announcer = { { 0, 0, 0 }, 0, 0, 0, 0, SPKR };
+CharSender hostSender = { { 0, 0, 0 }, 0, 0, 0, 0, TX };
+CharSender remoteSender = { { 0, 0, 0 }, 0, 0, 0, 0, TX };
+CharSender memorySender = { { 0, 0, 0 }, 0, 0, 0, 0, SPKR };
+WinKeyerParser hostParser;
+uint8_t hostText[128];                    // Type-ahead buffer: text and buffered commands
+int hostLength = 0;                       // bytes in it
+int hostPlay = 0;                         // next one to play
+int hostInput = 0;                        // where the next one from the host goes
+int hostSent = 0;                         // bytes before this one have gone to the server as text
 
 
 // RUN STATE
@@ -192,798 +340,2476 @@ int recording = 0;                        // Recording a memory
 int currStorageOffset = 3;                // Base offset for the EEPROM memory block is 3
 int playAlternate = 0;                    // Mode B completion flag
 int ditDetected = 0;                      // Dit paddle hit during Dah play
-int memSwitch = 0;                        // Memory switch set by readAnalog()
+int memSwitch = 0;                        // Memory switch as last read, for its press
 int netMode = netDisconnected;
 unsigned long lastPacketSentTime = 0;     // in milli time
 unsigned long keepAliveTimer = 0;         // in millis
 unsigned long lastSymPlayedTime = 0;      // in milli time
-unsigned long gap = 0;                    // gap from last packet sent to start of next char in millis
+unsigned long lastMarkEnd = 0;            // in milli time
 uint16_t packetCount = 0;
-unsigned int toSend = 0;                  // stage to assemble the data portion of packet
-uint16_t toChar = 0;                      // holds in bit pattern to be sent
-uint16_t toLength = 0;                    // number of elements to  the character
+uint8_t session = 0;                      // This boot's, sent with every frame
+int peerSession = -1;                     // The peer's, from its last datagram
+WireFrame toSend;                         // stage to assemble the character to be sent
 int lastPacketType = 0;                   // what was last sent
-int playNextPacket = 0;                   // buffer flag
-
+int keyerState = keyerIdle;               // Keyer engine state
+uint32_t keyerUntil = 0;                  // End of current mark or space in micro time
+uint32_t keyerNext = 0;                   // Earliest start of the next element in micro time
+int keyerSym = 0;                         // Symbol being played
+int keyerTransmit = 0;                    // Current symbol keys the rig
+int straightDown = 0;                     // Manual key is down
+int streamAnchored = 0;                   // Server has a playout timeline
+int streamStamped = 0;                    // Timeline is in server time
+unsigned long charStart = 0;              // When the character being assembled started
+unsigned long streamSenderEnd = 0;        // Sender time the last scheduled element ended
+unsigned long streamOffset = 0;           // Local time minus sender time for playout
+unsigned long streamBase = 0;             // streamOffset when the timeline was anchored
+uint32_t edgeLastSent = 0;                // Time of the last key edge streamed, in micro time
+unsigned long edgeSenderTime = 0;         // Sender time of the last key edge scheduled, in millis
+uint32_t edgeSenderMicros = 0;            // and the micros past that
+uint32_t manualDownAt = 0;                // When the server keyed down for a remote manual key
+unsigned long playoutSlips = 0;           // Runs that came in late and slipped the timeline
+unsigned long playoutDrops = 0;           // Runs too late to play at all
+uint32_t paddleDrops = 0;                 // Paddle edges lost to a full queue, as last seen
+volatile uint8_t outputEpoch = 0;         // Edges queued before an abort are skipped
+volatile uint32_t toneHalfPeriod = 0;     // Sidetone half period in micros, 0 when silent
+volatile uint32_t toneToggleAt = 0;       // Next sidetone edge in micro time
+volatile uint8_t speakerLevel = LOW;
+volatile uint8_t timerArmed = 0;          // timer1 will fire at timerAt
+volatile uint32_t timerAt = 0;
+unsigned long switchReadTime = 0;         // When the A0 switches were last read
+int switchValue = 0;                      // and what they read
+uint8_t settingsDirty = 0;                // Settings changed since the last commit
+unsigned long settingsChangedAt = 0;      // When one last changed
+unsigned long settingsCommits = 0;        // Storage commits since boot
+int linkState = linkDown;
+int linkCached = 0;                       // Joining with the cached BSSID and channel
+unsigned long linkStartedAt = 0;          // When joining started
+#ifdef WINKEYER
+const int serialText = 0;                 // The serial port speaks the WinKeyer protocol, no text
+#else
+const int serialText = 1;
+#endif
+int hostOpen = 0;                         // A WinKeyer host has opened the interface
+int hostPaused = 0;
+unsigned int hostSpeed = 200;             // Speed in tenths of WPM, outside buffered changes
+int hostSpeedBuffered = 0;                // A buffered speed change is in force
+int hostKeyed = 0;                        // A buffered key-down is queued, up to hostKeyUntil
+uint32_t hostKeyUntil = 0;
+uint8_t hostMode = 0;                     // WinKeyer mode register
+uint8_t hostStatus = wkStatus;            // Last status byte sent
+int hostBreakIn = 0;                      // The paddles cut the host off
+char announceText[24];                    // Text the announcer has still to play
+unsigned long statsSentAt = 0;            // When the last stats datagram went
+int playoutTransmit = TX;                 // What the server keys, SPKR for a monitor listener
+unsigned long subscribedAt = 0;           // When a monitor listener last subscribed
+unsigned long echoSender = 0;             // Sender time of the mark being keyed, for the echo
+uint32_t echoDownAt = 0;                  // and when it went down, in micro time
+uint32_t echoUpAt = 0;                    // When the last mark to echo ends, in micro time
+uint32_t sentDownAt = 0;                  // When the client's manual key went down, in micro time
+int serverBehind = 0;                     // The client has said the server is behind
+int remoteProsign = 0;                    // Remote text is between < and >
+MorseCode remoteMerge = { 0, 0, 0 };      // and the letters run together so far
+int recordSlot = 0;                       // Memory being recorded
+int memoryPlaying = 0;                    // A memory is being played from loop()
+int memoryAsText = 0;                     // and it goes to the server as text
+uint32_t memoryAt = 0;                    // When its next element is due, in micro time
+int memoryHeld = memoryNone;              // Code read from it, not yet in the text
+int memoryEnded = 0;                      // The last of it has been read as text
+MorseCode memoryCode = { 0, 0, 0 };       // Elements read of the next character
+char memoryText[wireMaxText + 1];         // Piece of it playing here, sent as a frame
+int memoryTextNext = 0;                   // next character of it to play
+int memoryTextSent = 0;                   // Some of it has gone to the server
+int memoryProsign = 0;                    // Memory text is between < and >
+MorseCode memoryMerge = { 0, 0, 0 };      // and the letters run together so far
+int memoryButton = 0;                     // Memory switch held, 0 for none
+unsigned long memoryButtonAt = 0;         // when it was pressed
+int memoryButtonLong = 0;                 // it has been held for a long press
+int memoryPage = 0;                       // Page of slots the memory switches play and record
+int setupDown = 0;                        // Setup button, debounced
+unsigned long setupChangedAt = 0;         // when it last changed
+unsigned long setupPressedAt = 0;         // when it was last pressed
+int setupNext = -1;                       // State to go to when it is let go, -1 for none
+int settingHeld = 0;                      // A paddle is held in a setting mode
+Beep beeps[12];                           // Tones and blinks to play
+int beepCount = 0;
+int beepNext = 0;                         // next one to play
+unsigned long beepUntil = 0;              // when the one playing ends
 
-DataPacket packet;
 
 
 // FORWARD DECLARATIONS
 
 void dumpSettingsToStorage();
-void processPaddles(int ditPressed, int dahPressed, int transmit, int memoryId);
-void memRecord(int memoryId, int value);
-void sendPacket(unsigned int sendData, unsigned long spacing);
+void processPaddles(int ditPressed, int dahPressed, int transmit);
+void memRecord(int value);
+void memoryStop();
+void beepAdd(unsigned int tone, int led, unsigned int length);
+int setupRead();
+void sendChar();
+void sendElement(int sym, unsigned long when);
+void sendEdges(int down, uint32_t at, uint32_t mark);
+void sendText(const char *text, int length, unsigned long when);
+void echoKeyed(uint32_t at, int down);
+int sendsText();
+int monitorBegin();
+int monitorOffer(const uint8_t *data, int size);
 
 
 // LOW LEVEL FUNCTIONS
 
-// Read the analog pin and assign a value to
-// global memSwitch.
+// Read the analog pin and return which switch is pressed.
+// analogRead() upsets the WiFi if called too often, and loop() no longer waits
+// between passes, so a read within switchPoll millis of the last one is reused.
 int readAnalog() {
+  unsigned long now = millis();
+  if (now - switchReadTime < switchPoll) { return switchValue; }
+  switchReadTime = now;
+
   int value = analogRead(PIN_A0);
-  if (value < 100) { return 0; }
-  else if (value > 400 && value < 600) { return 1; }
-  else if (value > 600 && value < 900) { return 2; }
-  else if (value > 900) { return 3; } 
-  return(0);
+  if (value < 100) { switchValue = 0; }
+  else if (value > 400 && value < 600) { switchValue = 1; }
+  else if (value > 600 && value < 900) { switchValue = 2; }
+  else if (value > 900) { switchValue = 3; }
+  else { switchValue = 0; }
+  return switchValue;
 }
 
 
-void playStraightKey(int releasePin) {
-  tone(pinSpeaker, toneFreq);
-  digitalWrite(pinStatusLed, HIGH);
-  digitalWrite(pinMosfet, HIGH);
+// PADDLE INPUT
+// Each paddle edge raises an interrupt that timestamps it into paddleEdges.
+// paddleService() feeds the edges through the integrator debounce, so a
+// press is seen at its real time however long the current pass of loop()
+// takes, and a tap shorter than a pass still counts.
 
-  while (digitalRead(releasePin) == LOW) {}
-  
-  noTone(pinSpeaker);
-  digitalWrite(pinStatusLed, LOW);
-  digitalWrite(pinMosfet, LOW);  
+void IRAM_ATTR paddleEdge(int pin) {
+  PaddleEdge edge = { (uint32_t) micros(), (uint8_t) pin, (uint8_t) (digitalRead(pin) == LOW) };
+  paddleEdges.push(edge);
 }
 
 
-// EEPROMr FUNCTIONS
+void IRAM_ATTR ditEdge() { paddleEdge(pinKeyDit); }
+void IRAM_ATTR dahEdge() { paddleEdge(pinKeyDah); }
 
-// Mark the end of a memory.
-void saveStorageEmptyPacket(int type) {
-  if (currStorageOffset + 1 >= storageSize) {
-    dumpSettingsToStorage();
-    return;
-  }
 
-  EEPROMr.write(currStorageOffset++, type);
-  EEPROMr.write(currStorageOffset, packetTypeEnd);
-  EEPROMr.commit();
+void paddleBegin() {
+  uint32_t now = micros();
+  ditPaddle.reset(digitalRead(pinKeyDit) == LOW, now);
+  dahPaddle.reset(digitalRead(pinKeyDah) == LOW, now);
+  attachInterrupt(digitalPinToInterrupt(pinKeyDit), ditEdge, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(pinKeyDah), dahEdge, CHANGE);
 }
 
 
-// Store an int in memory.
-void saveStorageInt(int type, int value) {
-  if (currStorageOffset + 1 + 2 >= storageSize) {
-    dumpSettingsToStorage();
-    return;
+// Take the queued edges. If the queue overflowed some are missing, so go by the pins as they are.
+void paddleService() {
+  PaddleEdge edge;
+  uint32_t now = micros();
+
+  while (paddleEdges.pop(edge)) {
+    if (edge.pin == pinKeyDit) { ditPaddle.edge(edge.closed, edge.at); }
+    else { dahPaddle.edge(edge.closed, edge.at); }
   }
-  EEPROMr.write(currStorageOffset++, type);
-  EEPROMr.write(currStorageOffset++, (value >> 8) & 0xFF);
-  EEPROMr.write(currStorageOffset++, value & 0xFF);
-  EEPROMr.write(currStorageOffset, packetTypeEnd);
-  EEPROMr.commit();
+  if (paddleEdges.drops() != paddleDrops) {
+    paddleDrops = paddleEdges.drops();
+    ditPaddle.edge(digitalRead(pinKeyDit) == LOW, now);
+    dahPaddle.edge(digitalRead(pinKeyDah) == LOW, now);
+  }
+  ditPaddle.settle(now);
+  dahPaddle.settle(now);
 }
 
 
-// Save recorded chars to a memory.
-void saveStorageMemory(int memoryId) {
-  if (currStorageOffset + 1 + 2 + memorySize[memoryId] >= storageSize) {
-    dumpSettingsToStorage();
-    return;
+// When the debounce passed the last change of a paddle, in micro time. Keying manual
+// edges at this time, rather than when loop() gets to them, keeps their timing exact.
+uint32_t paddleTime(const Debouncer &paddle) {
+  return paddle.changedAt() + paddleDebounce;
+}
+
+
+// The paddles are taking over from the announcer or the host: the presses that did it are
+// acted on now, so they must not count again as presses once the keyer is idle.
+void paddleTakeOver(int ditPressed, int dahPressed) {
+  if (ditPressed) { ditPaddle.takePress(); }
+  if (dahPressed) { dahPaddle.takePress(); }
+}
+
+
+// Debounced paddle state. While the keyer is idle, a press since the last
+// read counts as pressed, so it gets its element.
+void paddleRead(int *ditPressed, int *dahPressed) {
+  paddleService();
+  *ditPressed = ditPaddle.closed();
+  *dahPressed = dahPaddle.closed();
+  if (keyerState == keyerIdle) {
+    if (ditPaddle.takePress()) { *ditPressed = 1; }
+    if (dahPaddle.takePress()) { *dahPressed = 1; }
   }
+}
 
-  int type = 0;
-  if (memoryId == 0) { type = packetTypeMem0; }
-  else if (memoryId == 1) { type = packetTypeMem1; }
-  else if (memoryId == 2) { type = packetTypeMem2; }
 
-  EEPROMr.write(currStorageOffset++, type);
-  EEPROMr.write(currStorageOffset++, (memorySize[memoryId] >> 8) & 0xFF);
-  EEPROMr.write(currStorageOffset++, memorySize[memoryId] & 0xFF);
+// EEPROMr FUNCTIONS
+// Settings are appended to the storage log as records: type, payload length (2),
+// payload, and a CRC-8 of all of those. Changes are only noted in RAM by
+// settingsChanged(), and written out together, with one commit, by settingsFlush()
+// once they have been left alone for settingsIdle millis, or when a setting mode is
+// left. A record cut short by a power loss fails its CRC, and loadStorage() stops
+// there, with the settings from the records before it.
+
+uint8_t storageCrc(uint8_t crc, uint8_t value) {
+  crc ^= value;
+  for (int i = 0; i < 8; i++) { crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1; }
+  return crc;
+}
 
-  for (size_t i=0; i<memorySize[memoryId]; i++) EEPROMr.write(currStorageOffset++, memory[memoryId][i]);
-  
+
+// Append a record to the log, without committing. Returns false when it does not fit.
+bool storageWrite(int type, const uint8_t *payload, size_t length) {
+  if (currStorageOffset + 4 + length >= (size_t) storageSize) { return false; }
+
+  uint8_t header[3] = { (uint8_t) type, (uint8_t) (length >> 8), (uint8_t) length };
+  uint8_t crc = 0;
+  for (int i = 0; i < 3; i++) {
+    EEPROMr.write(currStorageOffset++, header[i]);
+    crc = storageCrc(crc, header[i]);
+  }
+  for (size_t i = 0; i < length; i++) {
+    EEPROMr.write(currStorageOffset++, payload[i]);
+    crc = storageCrc(crc, payload[i]);
+  }
+  EEPROMr.write(currStorageOffset++, crc);
   EEPROMr.write(currStorageOffset, packetTypeEnd);
-  EEPROMr.commit();
+  return true;
+}
+
+
+// Append the record for one setting.
+bool storageWriteSetting(uint8_t setting) {
+  uint8_t value[2];
+
+  if (setting == settingSpeed || setting == settingFreq) {
+    int v = (setting == settingSpeed) ? timing.speed() : toneFreq;
+    value[0] = (v >> 8) & 0xFF;
+    value[1] = v & 0xFF;
+    return storageWrite(setting == settingSpeed ? packetTypeWpm : packetTypeFreq, value, 2);
+  }
+  if (setting == settingMode) {
+    if (currKeyerMode == keyerModeVibroplex) { return storageWrite(packetTypeKeyerModeVibroplex, NULL, 0); }
+    if (currKeyerMode == keyerModeStraight) { return storageWrite(packetTypeKeyerModeStraight, NULL, 0); }
+    return storageWrite(packetTypeKeyerModeIambic, NULL, 0);
+  }
+  if (setting == settingWifi) { return storageWrite(packetTypeWifi, (const uint8_t *) &wifiCache, sizeof(wifiCache)); }
+  if (setting == settingPage) {
+    value[0] = memoryPage;
+    return storageWrite(packetTypePage, value, 1);
+  }
+  return true;
 }
 
 
+// The log is full: start it again, with one record of each setting.
 void dumpSettingsToStorage() {
   currStorageOffset = 5;
-  saveStorageInt(packetTypeSpeed, ditMillis);
-  saveStorageInt(packetTypeFreq, toneFreq);
-  if (currKeyerMode == keyerModeVibroplex) { saveStorageEmptyPacket(packetTypeKeyerModeVibroplex); }
-  else if (currKeyerMode == keyerModeStraight) { saveStorageEmptyPacket(packetTypeKeyerModeStraight); }
-  if (memorySize[0]) { saveStorageMemory(0); }
-  if (memorySize[1]) { saveStorageMemory(1); }
-  if (memorySize[2]) { saveStorageMemory(2); }
+  storageWriteSetting(settingSpeed);
+  storageWriteSetting(settingFreq);
+  storageWriteSetting(settingMode);
+  if (memoryPage) { storageWriteSetting(settingPage); }
+  if (wifiCached) { storageWriteSetting(settingWifi); }
+  EEPROMr.write(currStorageOffset, packetTypeEnd);
 }
 
 
-// SYMBOL GENERATION
+// Note a setting change, to be written out later.
+void settingsChanged(uint8_t settings) {
+  settingsDirty |= settings;
+  settingsChangedAt = millis();
+}
 
-// Delay that checks for dot insertion and optionally can be interrupted
-// by a pin meeting a condition. Return that pin.
-int delayInterruptable(int ms, int *pins, const int *conditions, size_t numPins) {
-  unsigned long finish = millis() + ms;
 
-  while(1) {
-    if (ms != -1 && millis() > finish) { return -1; }
+// Write out the changed settings, with a single commit.
+void settingsFlush() {
+  if (!settingsDirty) { return; }
 
-    if (prevSymbol == symDah) {
-      if (!ditDetected) { ditDetected = !digitalRead(pinKeyDit); }
-    }
-    for (size_t i=0; i < numPins; i++) {
-      if (digitalRead(pins[i]) == conditions[i]) { return pins[i]; }
+  for (uint8_t setting = 1; setting; setting <<= 1) {
+    if (!(settingsDirty & setting)) { continue; }
+    if (!storageWriteSetting(setting)) {
+      dumpSettingsToStorage();
+      break;
     }
   }
+  settingsDirty = 0;
+  EEPROMr.commit();
+  settingsCommits++;
 }
 
 
-// Wait for pin to change state.
-void waitPin(int pin, int condition) {
-  int pins[1] = { pin };
-  int conditions[1] = { condition };
-  delayInterruptable(-1, pins, conditions, 1);
-  delay(250); // debounce
+// Flush changed settings once they have settled, while the keyer is idle, as a
+// commit stops the CPU for a few millis.
+void settingsService() {
+  if (!settingsDirty || millis() - settingsChangedAt < settingsIdle) { return; }
+  if (keyerState != keyerIdle || straightDown || !outputEdges.isEmpty()) { return; }
+  settingsFlush();
 }
 
 
-// Play a symbol but watch for changed state in pin(s).
-// Add char to packet for network.
-int playSymInterruptableVec(int sym, int transmit, int *pins, int *conditions, size_t numPins) {
+// OUTPUT SCHEDULER
+// The rig line, the status LED and the sidetone are driven from the timer1
+// interrupt, off a queue of timed edges, so an element is as long as it
+// should be to the microsecond however busy loop() is. The sidetone is a
+// square wave toggled from the same interrupt, as the core's tone() needs
+// timer1 for itself; all sound goes through outputTone().
 
-  unsigned int newGap = millis() - lastSymPlayedTime;
-  if (newGap > 5) { gap = newGap + ditMillis; }
+void IRAM_ATTR outputArm(uint32_t at, uint32_t now) {
+  int32_t wait = (int32_t) (at - now);
+  if (wait < 2) { wait = 2; }
+  timerAt = at;
+  timerArmed = 1;
+  timer1_write(wait * outTicksPerMicro);
+}
 
-  prevSymbol = sym;
 
-  tone(pinSpeaker, toneFreq);
-  digitalWrite(pinStatusLed, HIGH);
-  if (transmit) { digitalWrite(pinMosfet, HIGH); }
-  
-  int ret = delayInterruptable(ditMillis * (sym == symDit ? 1 : 3), pins, conditions, numPins);
+void IRAM_ATTR outputApply(const OutputEdge &edge, uint32_t now) {
+  if (edge.what & outKeyLines) {
+    digitalWrite(pinMosfet, (edge.what & outRig) ? HIGH : LOW);
+    digitalWrite(pinStatusLed, (edge.what & outLed) ? HIGH : LOW);
+  }
+  if (edge.what & outSound) {
+    toneHalfPeriod = edge.tone ? 500000 / edge.tone : 0;
+    toneToggleAt = now;
+    if (!edge.tone && speakerLevel) {
+      speakerLevel = LOW;
+      digitalWrite(pinSpeaker, LOW);
+    }
+  }
+}
 
-  noTone(pinSpeaker);
-  digitalWrite(pinStatusLed, LOW);
-  digitalWrite(pinMosfet, LOW);
 
-  if ((netMode == netClient) && transmit && (currKeyerMode == keyerModeIambic)) {
-    toChar = (toChar << 2) + sym;
-    toLength++;
+// timer1 interrupt: play the edges that are due, toggle the sidetone, and set up the next wake.
+void IRAM_ATTR outputTimer() {
+  uint32_t now = micros();
+  OutputEdge edge;
+
+  timerArmed = 0;
+  while (outputEdges.peek(edge) && (edge.epoch != outputEpoch || (int32_t) (edge.at - now) <= 0)) {
+    outputEdges.pop(edge);
+    if (edge.epoch == outputEpoch) { outputApply(edge, now); }
+  }
+  if (toneHalfPeriod && (int32_t) (toneToggleAt - now) <= 0) {
+    speakerLevel = !speakerLevel;
+    digitalWrite(pinSpeaker, speakerLevel);
+    toneToggleAt += toneHalfPeriod;
+    if ((int32_t) (toneToggleAt - now) <= 0) { toneToggleAt = now + toneHalfPeriod; }
   }
 
-  if (ret != -1) { return ret; }
+  int have = outputEdges.peek(edge);
+  uint32_t next = edge.at;
+  if (toneHalfPeriod && (!have || (int32_t) (toneToggleAt - next) < 0)) {
+    next = toneToggleAt;
+    have = 1;
+  }
+  if (have) { outputArm(next, now); }
+}
 
-  ret = delayInterruptable(ditMillis, pins, conditions, numPins);
-  if (ret != -1) { return ret; }
 
-  lastSymPlayedTime = millis();  
-  return -1;
+void outputBegin() {
+  timer1_attachInterrupt(outputTimer);
+  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_SINGLE);
 }
 
 
-void playSym(int sym, int transmit, int memoryId, int toRecord) {
+// Queue an edge, and bring the timer forward if it is due before the next wake.
+// Edges must be queued in time order.
+void outputQueue(uint32_t at, uint8_t what, uint16_t frequency) {
+  OutputEdge edge = { at, frequency, what, outputEpoch };
+
+  outputEdges.push(edge);
+  noInterrupts();
+  if (!timerArmed || (int32_t) (at - timerAt) < 0) { outputArm(at, micros()); }
+  interrupts();
+}
 
 
-  playSymInterruptableVec(sym, transmit, NULL, NULL, 0);
-  if (memoryId) { memRecord(memoryId, toRecord); }
-  lastSymPlayedTime = millis(); 
+// Key the outputs up or down at a time.
+void outputKey(uint32_t at, int down, int transmit) {
+  if (down) { outputQueue(at, outKeyLines | outLed | (transmit ? outRig : 0) | outSound, toneFreq); }
+  else { outputQueue(at, outKeyLines | outSound, 0); }
+  if (echoKeying && transmit && netMode == netServer) { echoKeyed(at, down); }
 }
 
 
-int playSymInterruptable(int sym, int transmit, int pin, int condition) {
-  int pins[1] = { pin };
-  int conditions[1] = { condition };
-  return playSymInterruptableVec(sym, transmit, pins, conditions, 1);
+// The millis of a time in micro time, near now.
+unsigned long millisAt(uint32_t at) {
+  return millis() + (int32_t) (at - micros()) / 1000;
 }
 
 
-// MORSE PLAYER FUNCTIONS
+// Sound the speaker now, 0 for silence. Stands in for tone() and noTone().
+void outputTone(unsigned int frequency) {
+  outputQueue(micros(), outSound, frequency);
+}
 
-int playChar(const char oneChar, int transmit) {
-  int pins[2] = { pinKeyDit, pinKeyDah };
-  int conditions[2] = { LOW, LOW };
-  int inchar = 0;
-  int ret = 0;
 
-  for (unsigned int j = 0; j < 8; j++) {
-      int bit = morse_ascii[(int)oneChar] & (0x80 >> j);
-      if (inchar) {
-            ret = playSymInterruptableVec(bit + 1, transmit, pins, conditions, 2);
-            if (ret != -1) {
-              waitPin(ret, HIGH);
-              return ret;
-            }
-      } else if (bit) { inchar = 1; }
- }
-  delay(ditMillis * 2);
-  return 0;
+// Drop whatever is queued, and key up now.
+void outputAbort() {
+  outputEpoch++;
+  outputKey(micros(), 0, 0);
 }
 
 
-int playStr(const char *oneString, int transmit) {
+// KEYER ENGINE
+// Elements are played by a state machine that is advanced by keyerService()
+// on every pass of loop(), so the paddles, UDP and switches keep being
+// serviced while an element is keyed. Each element's edges are queued for
+// the output scheduler when it starts, and the engine goes idle keyerLead
+// micros before the space ends, so the next element is queued in time to
+// start exactly when the space does.
 
-  for (unsigned int j = 0; j < strlen(oneString); j++) {
-    if (oneString[j] == ' ') { delay(ditMillis * 7); }
-    else { 
-      int ret = playChar(oneString[j], transmit);
-      if (ret != 0) { return ret; }
-    }
+// Start playing a symbol. Returns immediately, keyerService() finishes it.
+void keyerStart(int sym, int transmit) {
+
+  prevSymbol = sym;
+  keyerSym = sym;
+  keyerTransmit = transmit;
+  uint32_t nowMicros = micros();
+  uint32_t start = (int32_t) (keyerNext - nowMicros) > 0 ? keyerNext : nowMicros;
+  keyerUntil = start + (sym == symDit ? timing.dit() : timing.dah());
+  outputKey(start, 1, transmit);
+  outputKey(keyerUntil, 0, transmit);
+  keyerState = keyerMark;
+
+  unsigned long now = millis() + (start - nowMicros) / 1000;
+  if (echoKeying && (netMode == netClient) && transmit) {
+    SentMark sent = { now, keyerUntil - start };
+    sentMarks.push(sent);
+  }
+  if (toSend.length == 0) {
+    charStart = now;
+    toSend.gap = now - lastMarkEnd;
+  }
+
+  if (streamElements && (netMode == netClient) && transmit && (currKeyerMode == keyerModeIambic)) {
+    sendElement(sym, now);
+  }
+  if ((netMode == netClient) && transmit && (currKeyerMode != keyerModeIambic)) {
+    sendEdges(1, start, keyerUntil - start);
   }
-  return 0;
 }
 
 
-int playSpeed() {
+// The mark of the current symbol is over: add it to the packet for network.
+void keyerEndMark() {
+  lastMarkEnd = millis();
 
-  char frame[10];
-  int speed = 1200 / ditMillis;
-  itoa(speed, frame, 10);
-  delay(250);
-  int ret = playStr(frame, SPKR);
-  if (ret) { return ret; }
-  delay(250);
-  return 0;
+  if (!streamElements && (netMode == netClient) && keyerTransmit && (currKeyerMode == keyerModeIambic)) {
+    wireAppend(toSend, keyerSym == symDah);
+  }
 }
 
 
-// MEMORY RECORDING FUNCTIONS
+// Advance the keyer state machine. Checks for dot insertion during a dah.
+void keyerService() {
+  if (keyerState == keyerIdle) { return; }
 
-// Record a char in the memory buffer.
-void memRecord(int memoryId, int value) {
-  memory[memoryId][memorySize[memoryId]] = value;
-  memorySize[memoryId]++;
-}
+  if (prevSymbol == symDah) {
+    paddleService();
+    if (!ditDetected) { ditDetected = ditPaddle.closed() || ditPaddle.pressSeen(); }
+  }
 
+  uint32_t now = micros();
+  if (keyerState == keyerMark) {
+    if ((int32_t) (now - keyerUntil) < 0) { return; }
+    keyerEndMark();
+    keyerState = keyerSpace;
+    keyerUntil += timing.space();
+  }
+  if ((int32_t) (keyerUntil - now) <= (int32_t) keyerLead) {
+    keyerState = keyerIdle;
+    keyerNext = keyerUntil;
+    lastSymPlayedTime = millis();
+  }
+}
 
-// Record a memory.
-void setMemory(int memoryId, int pin, int inverted) {
-  memorySize[memoryId] = 0;
-  playSym(symDah, SPKR, NO_REC, 0);
-  delay(50);
-  playSym(symDah, SPKR, NO_REC, 0);
-  delay(50);
-  playSym(symDah, SPKR, NO_REC, 0);
-  delay(50);
-  recording = 2;
-  
-  while(1) {
-    delay(0);
-    int ditPressed = (digitalRead(pinKeyDit) == LOW);
-    int dahPressed = (digitalRead(pinKeyDah) == LOW);
-    delay(3);
-    ditPressed = ditPressed & (digitalRead(pinKeyDit) == LOW);
-    dahPressed = dahPressed & (digitalRead(pinKeyDah) == LOW);
-
-    if ((ditPressed || dahPressed) && (millis() - lastSymPlayedTime > ditMillis)) {
-      // record a space;
-
-      if (recording == 2) {
-        recording = 1;
-      } else {
-        double spaceDuration = (millis() - lastSymPlayedTime) / (ditMillis / 3);
-        spaceDuration += 2.5;
-        int toRecord = spaceDuration;
-        if (toRecord > 255) { toRecord = 255; }
-        memRecord(memoryId, toRecord);
-      }
-    }
 
-    processPaddles(ditPressed, dahPressed, SPKR, memoryId);
+// Stop the current symbol early.
+void keyerAbort() {
+  if (keyerState == keyerMark) {
+    outputAbort();
+    keyerEndMark();
+  }
+  keyerState = keyerIdle;
+  keyerNext = micros();
+}
 
-    if (memorySize[memoryId] >= sizeof(memory[memoryId])-2) { break; } // protect against overflow
 
-    if (digitalRead(pinSetup) == (inverted ? HIGH : LOW)) {
-      delay(50);
-      waitPin(pinSetup, inverted ? LOW : HIGH);
-      break;
+// Follow a manual key (straight key, or vibroplex dah side). at is when the
+// key moved, in micro time; a key-down during the space after a dit waits for it.
+void keyerManual(int down, int transmit, uint32_t at) {
+  if (down == straightDown) { return; }
+  straightDown = down;
+  if ((int32_t) (keyerNext - at) > 0) { at = keyerNext; }
+  outputKey(at, down, transmit);
+  if ((netMode == netClient) && transmit) { sendEdges(down, at, 0); }
+  if (echoKeying && (netMode == netClient) && transmit) {
+    if (down) { sentDownAt = at; }
+    else {
+      SentMark sent = { millisAt(sentDownAt), at - sentDownAt };
+      sentMarks.push(sent);
     }
   }
-  
-  saveStorageMemory(memoryId);
-  recording = 0;
+}
 
-  tone(pinSpeaker, 1300);
-  delay(300);
-  tone(pinSpeaker, 900);
-  delay(300);
-  tone(pinSpeaker, 2000);
 
-  for (int i=0; i<=memoryId; i++) {
-    digitalWrite(pinStatusLed, HIGH);
-    delay(150);
-    digitalWrite(pinStatusLed, LOW);
-    delay(150);
-  }
+// CHARACTER SENDER
+// Keys text a character at a time from loop(), without blocking: an element is started
+// each time the keyer engine comes free, and the spaces between characters and words are
+// made by moving the sender's due time on. The announcer and the host interface each
+// have one.
 
-  noTone(pinSpeaker);
+// Load a character to send, with gap micros of space after it (timing.character() after
+// a character, timing.word() more for a word space).
+void senderLoad(CharSender &sender, const MorseCode &code, uint32_t gap) {
+  sender.code = code;
+  sender.element = 0;
+  sender.gap = gap;
+  sender.busy = 1;
 }
 
 
-// Play a memory. Build packet if needed.
-void playMemory(int memoryId) {
-  if (memorySize[memoryId] == 0) {
-    tone(pinSpeaker, 800);
-    delay(200);
-    tone(pinSpeaker, 500);
-    delay(300);
-    noTone(pinSpeaker);
-    return;
-  }
+// Start the next element when it is due. Returns 1 when the sender is free for another
+// character.
+int senderService(CharSender &sender) {
+  if (!sender.busy) { return 1; }
+  if (keyerState != keyerIdle) { return 0; }
 
-  int pins[2] = { pinKeyDit, pinKeyDah };
-  int conditions[2] = { LOW, LOW };
-  int duration = 0;
-  toSend = 0;
-  toChar = 0;
-  toLength = 0;
-  int cmd = 0;
+  uint32_t now = micros();
+  if (!sender.element && (int32_t) (sender.at - now) < 0) { sender.at = now; }
+  if ((int32_t) (sender.at - now) > (int32_t) keyerLead) { return 0; }
 
-  for (size_t i=0; i <= memorySize[memoryId]; i++) {
+  if (sender.element < sender.code.length) {
+    if ((int32_t) (sender.at - keyerNext) > 0) { keyerNext = sender.at; }
+    keyerStart(morseElementAt(sender.code, sender.element++) ? symDah : symDit, sender.transmit);
+    sender.at = keyerUntil + timing.space();
+    return 0;
+  }
+  sender.at += sender.gap;
+  sender.busy = 0;
+  return 1;
+}
 
-    if (i == memorySize[memoryId]) { cmd = 5; }
-    else { cmd = memory[memoryId][i]; }
 
-    DEBUG_PRINT("cmd: ");
-    DEBUG_PRINTLN(cmd);
-    if (cmd == 0 || cmd == 1) {
-      int ret = playSymInterruptableVec(cmd+1, TX, pins, conditions, 2);
-      if (ret != -1) {
-        waitPin(ret, HIGH);
-        return;
-      }
-    } else if (cmd > 4)   {
-      toChar = toChar << (16 - (toLength * 2));
-      toSend = (toLength << 16) + toChar;
-      DEBUG_PRINT("Duration sent: ");
-      DEBUG_PRINTLN(duration);
-      sendPacket(toSend, duration);
-      lastPacketType = udpFrame;
-      toSend = 0;
-      toChar = 0;
-      toLength = 0;
-      duration = cmd - 4;
-      duration *= (ditMillis / 3);
-      delay(duration);
-      duration += 100;
-      DEBUG_PRINT("Duration calced: ");
-      DEBUG_PRINTLN(duration);
-    }
+// Load a character of text. A space is a word space, and letters between < and > are run
+// together as a prosign, which is loaded at the >. Returns 1 if a character was loaded.
+int senderText(CharSender &sender, char c, int &prosign, MorseCode &merge) {
+  if (c == '<') {
+    prosign = 1;
+    merge = morseTable[0];
+    return 0;
+  }
+  if (prosign && c != '>') {
+    merge = morseMerge(merge, morseTable[c]);
+    return 0;
   }
+  if (c == '>') {
+    prosign = 0;
+    senderLoad(sender, merge, timing.character());
+  } else if (c == ' ') {
+    senderLoad(sender, morseTable[0], timing.word());
+  } else {
+    senderLoad(sender, morseTable[c], timing.character());
+  }
+  return 1;
 }
 
 
-// Read memory switches and countdown to record.
-void checkMemoryPin(int memoryId, int pin, int inverted) {
-  if (readAnalog() == pin) {
-    unsigned long whenStartedPress = millis();
-    int doingSet = 0;
-      
-    delay(5);
-        
-    while (readAnalog() == pin) {
-      // 3 second long press to enter memory recording mode
-      if (millis() > whenStartedPress + 1000) {
-        playSym(symDit, SPKR, NO_REC, 0);
-        delay(500);
-        playSym(symDit, SPKR, NO_REC, 0);
-        delay(500);
-        playSym(symDit, SPKR, NO_REC, 0);
-        delay(500);
-        playSym(symDit, SPKR, NO_REC, 0);
-//        digitalWrite(pinStatusLed, HIGH);
-        doingSet = 1;
-      }
-    }
+// Drop the character being sent, and cut short its element. A dit paddle press seen during
+// one of its dahs was not for it, so it is not inserted after.
+void senderStop(CharSender &sender) {
+  if (sender.busy && keyerState != keyerIdle && keyerTransmit == sender.transmit) { keyerAbort(); }
+  if (sender.busy) { ditDetected = 0; }
+  sender.busy = 0;
+}
+
+
+// Announce text on the sidetone, from loop(), so the paddles work all the while.
+// Text is added to whatever is still to play. A paddle press stops it at once.
+void announce(const char *text) {
+  size_t length = strlen(announceText);
+  if (length && length < sizeof(announceText) - 1) { announceText[length++] = ' '; }
+  strncpy(announceText + length, text, sizeof(announceText) - 1 - length);
+  announceText[sizeof(announceText) - 1] = 0;
+}
 
-    digitalWrite(pinStatusLed, LOW);
-    delay(50);
 
-    if (doingSet) { setMemory(memoryId, pin, inverted); }
-    else { playMemory(memoryId); }
+// Play the announcement. The paddles, the host, and on the server remote keying, take
+// over from the announcer.
+void announceService(int ditPressed, int dahPressed) {
+  if (!announceText[0] && !announcer.busy) { return; }
+  if (ditPressed || dahPressed || straightDown || !elements.isEmpty() || !keyEdges.isEmpty() || hostSender.busy
+    || remoteSender.busy) {
+    senderStop(announcer);
+    paddleTakeOver(ditPressed, dahPressed);
+    announceText[0] = 0;
+    return;
   }
+  if (!senderService(announcer) || !announceText[0]) { return; }
+
+  char c = announceText[0];
+  memmove(announceText, announceText + 1, sizeof(announceText) - 1);
+  if (c == ' ') { senderLoad(announcer, morseTable[0], timing.word()); }
+  else { senderLoad(announcer, morseTable[c], timing.character()); }
+  senderService(announcer);
 }
 
 
-// PADDLE ADJUSTMENT INPUT FUNCTIONS
-// These are used to adjust program parameters via the paddles.
+// HOST INTERFACE
+// A WinKeyer 2 compatible command set on the serial port (see WinKeyer.h), so logging
+// and contest programs can send through the keyer. Text and buffered commands go into
+// a type-ahead buffer, and are keyed from it back to back, with no gap between one
+// message and the next beyond the normal character space. Weighting, ratio and Farnsworth
+// set the timing table; HSCW, PTT and the like are taken and ignored. On a client, the text goes to the server
+// as text frames, as far ahead as the next command each time, and is only heard here.
 
-int scaleDown(int orig, double factor, int lowerLimit) {
-  int scaled = (int)((double)orig * factor);
-  if (scaled == orig) { scaled--; }
-  if (scaled < lowerLimit) { scaled = lowerLimit; }
-  return scaled;
+// Send a byte to the host.
+void hostReply(uint8_t b) {
+  Serial.write(b);
 }
 
 
-int scaleUp(int orig, double factor, int upperLimit) {
-  int scaled = (int)((double)orig * factor);
-  if (scaled == orig) { scaled++; }
-  if (scaled > upperLimit) { scaled = upperLimit; }
-  return scaled;
+// Go back to the speed from before a buffered speed change.
+void hostRestoreSpeed() {
+  if (!hostSpeedBuffered) { return; }
+  hostSpeedBuffered = 0;
+  timing.setSpeed(hostSpeed);
 }
 
 
-// INITIALIZATION FUNCTIONS
+// Cut a buffered key-down short: drop its queued edges, key up now, and free the keyer.
+void hostKeyStop() {
+  if (!hostKeyed) { return; }
+  hostKeyed = 0;
+  if ((int32_t) (micros() - hostKeyUntil) >= 0) { return; }
+  outputAbort();
+  keyerNext = micros();
+}
 
-void factoryReset() {
-  if (EEPROMr.read(3) != storageMagic1) EEPROMr.write(0, storageMagic1);
-  if (EEPROMr.read(4) != storageMagic2) EEPROMr.write(1, storageMagic2);
-  if (EEPROMr.read(5) != packetTypeEnd) EEPROMr.write(2, packetTypeEnd);
 
-  currStorageOffset = 5;
+// Empty the type-ahead buffer, and stop sending.
+void hostClear() {
+  if (sendsText() && (hostSent || hostSender.busy)) { sendText(NULL, 0, millis()); }
+  hostSent = 0;
+  hostLength = 0;
+  hostPlay = 0;
+  hostInput = 0;
+  hostPaused = 0;
+  senderStop(hostSender);
+  hostKeyStop();
+  hostRestoreSpeed();
+}
 
-  tone(pinSpeaker, 900);
-  delay(300);
-  tone(pinSpeaker, 600);
-  delay(300);
-  tone(pinSpeaker, 1500);
-  delay(900);
-  noTone(pinSpeaker);
+
+// Put a byte from the host in the type-ahead buffer, at the input pointer.
+void hostBuffer(uint8_t b) {
+  if (hostInput >= (int) sizeof(hostText) && hostPlay) {           // Make room
+    memmove(hostText, hostText + hostPlay, hostLength - hostPlay);
+    hostLength -= hostPlay;
+    hostInput -= hostPlay;
+    hostSent = hostSent > hostPlay ? hostSent - hostPlay : 0;
+    hostPlay = 0;
+  }
+  if (hostInput >= (int) sizeof(hostText)) { return; }                // Host ignored XOFF
+  hostText[hostInput++] = b;
+  if (hostInput > hostLength) { hostLength = hostInput; }
 }
 
 
-void loadStorage() {
-  // Reset the configuration byng both paddles while the keyer is started.
-  // Memory layout:
-  // Bytes 0, 2, 1 : Reserved for rotation library signature.
-  // Bytes 3, 4 : Reserved for magic numbers.
-  // Bytes 5 - 1024 : memory packets.
+void hostSetSpeed(int wpm) {
+  if (wpm < 5 || wpm > 99) { return; }
+  hostSpeed = wpm * 10;
+  hostSpeedBuffered = 0;
+  timing.setSpeed(hostSpeed);
+}
 
-  int resetRequested = (digitalRead(pinKeyDit) == LOW) && (digitalRead(pinKeyDah) == LOW);
 
-  if (resetRequested || EEPROMr.read(3) != storageMagic1 || EEPROMr.read(4) != storageMagic2) { factoryReset(); }
+// Act on a command from the host.
+void hostCommand(const WinKeyerParser &p) {
+  uint8_t command = p.command;
 
-  currStorageOffset = 5;
-  
-  while (1) {
-    int packetType = EEPROMr.read(currStorageOffset);
-    if (packetType == packetTypeEnd) {
+  if (command >= wkBufferedPtt) {                                       // Text, buffered commands
+    hostBuffer(command);
+    for (int i = 0; i < p.count; i++) { hostBuffer(p.args[i]); }
+    return;
+  }
+
+  switch (command) {
+    case wkAdmin:
+      if (p.args[0] == wkAdminOpen) {
+        hostOpen = 1;
+        hostClear();
+        hostReply(wkVersion);
+      } else if (p.args[0] == wkAdminClose) {
+        hostOpen = 0;
+        hostClear();
+      } else if (p.args[0] == wkAdminReset) {
+        hostClear();
+        hostMode = 0;
+      } else if (p.args[0] == wkAdminEcho) {
+        hostReply(p.args[1]);
+      }
       break;
-    } else if (packetType == packetTypeSpeed) {
-      ditMillis = (EEPROMr.read(currStorageOffset+1) << 8) | EEPROMr.read(currStorageOffset+2);
-      currStorageOffset += 2;
-    } else if (packetType == packetTypeFreq) {
-      toneFreq = (EEPROMr.read(currStorageOffset+1) << 8) | EEPROMr.read(currStorageOffset+2);
-      currStorageOffset += 2;
-    } else if (packetType == packetTypeKeyerModeIambic) {
-      currKeyerMode = keyerModeIambic;
-    } else if (packetType == packetTypeKeyerModeVibroplex) {
-      currKeyerMode = keyerModeVibroplex;
-    } else if (packetType == packetTypeKeyerModeStraight) {
-      currKeyerMode = keyerModeStraight;
-    } else if (packetType >= packetTypeMem0 && packetType <= packetTypeMem2) {
-      int memoryId = 0;
-      if (packetType == packetTypeMem0) { memoryId = 0; }
-      if (packetType == packetTypeMem1) { memoryId = 1; }
-      if (packetType == packetTypeMem2) { memoryId = 2; }
-      memorySize[memoryId] = (EEPROMr.read(currStorageOffset+1) << 8) | EEPROMr.read(currStorageOffset+2);
-      for (size_t i = 0; i < memorySize[memoryId]; i++) {
-        memory[memoryId][i] = EEPROMr.read(currStorageOffset + 3 + i);
+    case wkSidetone:
+      if (p.args[0] & 0x0F) { toneFreq = 4000 / (p.args[0] & 0x0F); }
+      break;
+    case wkSpeed:
+      hostSetSpeed(p.args[0]);
+      break;
+    case wkWeighting:
+      timing.setWeight(p.args[0]);
+      break;
+    case wkRatio:
+      timing.setRatio(p.args[0]);
+      break;
+    case wkFarnsworth:
+      timing.setFarnsworth(p.args[0]);
+      break;
+    case wkPause:
+      hostPaused = p.args[0];
+      break;
+    case wkGetSpeedPot:
+      hostReply(wkSpeedPot);                                        // No pot
+      break;
+    case wkBackspace:
+      if (hostLength > hostPlay) { hostLength--; }
+      if (hostInput > hostLength) { hostInput = hostLength; }
+      break;
+    case wkClear:
+      hostClear();
+      break;
+    case wkKeyImmediate:
+      keyerManual(p.args[0] ? 1 : 0, TX, micros());
+      break;
+    case wkMode:
+      hostMode = p.args[0];
+      break;
+    case wkLoadDefaults:
+      hostMode = p.args[0];
+      hostSetSpeed(p.args[1]);
+      if (p.args[2] & 0x0F) { toneFreq = 4000 / (p.args[2] & 0x0F); }
+      timing.setWeight(p.args[3]);
+      timing.setFarnsworth(p.args[10]);
+      timing.setRatio(p.args[12]);
+      break;
+    case wkGetStatus:
+      hostReply(hostStatus);
+      break;
+    case wkPointer:
+      if (p.args[0] == wkPointerReset) { hostClear(); }
+      else if (p.args[0] == wkPointerOverwrite) { hostInput = hostPlay; }
+      else if (p.args[0] == wkPointerAppend) { hostInput = hostLength; }
+      else if (p.args[0] == wkPointerNulls) {
+        for (int i = 0; i < p.args[1]; i++) { hostBuffer(wkBufferedNop); }
       }
-      currStorageOffset += 2 + memorySize[memoryId];
-    }
+      break;
+  }
+}
+
 
-    currStorageOffset++; // packet type byte
+// Client mode - send the server the text in the type-ahead buffer from a byte on, up to
+// the next command, or as much as fits in a frame. A merge goes as a prosign. A backspace
+// cannot take back what has gone.
+void hostSendText(int from) {
+  char text[wireMaxText];
+  int length = 0;
+  int i = from;
+
+  while (i < hostInput) {
+    uint8_t b = hostText[i];
+    if (b == wkMerge) {
+      if (i + 2 >= hostInput || length + 4 > wireMaxText) { break; }
+      text[length++] = '<';
+      text[length++] = hostText[i + 1];
+      text[length++] = hostText[i + 2];
+      text[length++] = '>';
+      i += 3;
+    } else {
+      if (b < 0x20 || b == '<' || b == '>' || length == wireMaxText) { break; }
+      text[length++] = b;
+      i++;
+    }
   }
+  hostSent = i;
+  if (length) { sendText(text, length, millis() + (int32_t) (hostSender.at - micros()) / 1000); }
 }
 
 
-void setup() {
-  Serial.begin(115200);
+// Key the next thing in the type-ahead buffer, once the sender is free for it.
+void hostPlayNext() {
+  if (!senderService(hostSender) || hostPaused || hostPlay >= hostLength) { return; }
+  if (hostPlay >= hostInput && hostInput < hostLength) { return; }     // Being overwritten
+
+  uint8_t b = hostText[hostPlay];
+  int args = (b < 0x20) ? wkBufferedArgs(b) : 0;
+  if (hostPlay + args >= hostLength) { return; }                       // Not all here yet
+  const uint8_t *arg = hostText + hostPlay + 1;
+  hostPlay += 1 + args;
+  if (hostInput < hostPlay) { hostInput = hostPlay; }
+
+  uint32_t now = micros();
+  if ((int32_t) (hostSender.at - now) < 0) { hostSender.at = now; }
+  int from = hostPlay - 1 - args;
+  if (sendsText() && from >= hostSent && (b >= 0x20 || b == wkMerge)) { hostSendText(from); }
+  hostSender.transmit = (from < hostSent) ? SPKR : TX;
+  switch (b) {
+    case ' ':
+      senderLoad(hostSender, morseTable[0], timing.word());
+      break;
+    case wkBufferedKey: {
+      uint32_t until = hostSender.at + arg[0] * 1000000UL;
+      outputKey(hostSender.at, 1, TX);
+      outputKey(until, 0, TX);
+      keyerNext = until;
+      hostKeyed = 1;
+      hostKeyUntil = until;
+      hostSender.at = until;
+      senderLoad(hostSender, morseTable[0], 0);
+      break;
+    }
+    case wkBufferedWait:
+      hostSender.at += arg[0] * 1000000UL;
+      senderLoad(hostSender, morseTable[0], 0);
+      break;
+    case wkMerge:
+      senderLoad(hostSender, morseMerge(morseTable[arg[0]], morseTable[arg[1]]), timing.character());
+      break;
+    case wkBufferedSpeed:
+      if (arg[0] >= 5 && arg[0] <= 99) {
+        timing.setSpeed(arg[0] * 10);
+        hostSpeedBuffered = 1;
+      }
+      break;
+    case wkCancelSpeed:
+      hostRestoreSpeed();
+      break;
+    default:
+      if (b < 0x20) { break; }                                           // PTT, HSCW, NOP
+      if (hostMode & wkModeSerialEcho) { hostReply(b); }
+      senderLoad(hostSender, morseTable[b], timing.character());
+  }
+  if (hostPlay >= hostLength) {                                         // All taken, start over
+    hostSent = 0;
+    hostLength = 0;
+    hostPlay = 0;
+    hostInput = 0;
+  }
+  senderService(hostSender);
+}
 
-  pinMode(pinSetup, INPUT_PULLUP);
-  pinMode(pinKeyDit, INPUT_PULLUP);
-  pinMode(pinKeyDah, INPUT_PULLUP);
-  
-  pinMode(D1, OUTPUT);
-  digitalWrite(D1, LOW);
-  pinMode(D2, OUTPUT);
-  digitalWrite(D2, LOW);
-  pinMode(D3, OUTPUT);
-  digitalWrite(D3, LOW); 
-  pinMode(pinStatusLed, OUTPUT);
-  pinMode(pinMosfet, OUTPUT);
-  pinMode(pinSpeaker, OUTPUT);
-  EEPROMr.size(4);                      // Create 4 memory blocks for rotation. Adjust for memory size.
-  EEPROMr.begin(1024);
-  loadStorage();
 
-  playSpeed();
-  delay(250);
-  
-#ifdef CLIENT
-  netMode = netClient;
-#elif SERVER
-  netMode = netServer;
-#else
-  netmode = readAnalog();
-#endif
+// Read commands from the host, key the buffer, and tell the host when the status changes.
+// The paddles break in: they clear the buffer and take over.
+void hostService(int ditPressed, int dahPressed) {
+  while (Serial.available() > 0) {
+    if (hostParser.feed(Serial.read())) { hostCommand(hostParser); }
+  }
 
-  if (netMode == netClient || netMode == netServer) {
-    WiFi.setSleepMode(WIFI_NONE_SLEEP);
-    WiFi.begin(ssid, password);
-    while (WiFi.status() != WL_CONNECTED) {
-      delay(500);
-      DEBUG_PRINTLN("...");
-    }
-    DEBUG_PRINT("WiFi connected with IP: ");
-    DEBUG_PRINTLN(WiFi.localIP());
+  hostBreakIn = ditPressed || dahPressed || (straightDown && !hostSender.busy);
+  if (hostBreakIn && (hostSender.busy || hostLength)) {
+    hostClear();
+    paddleTakeOver(ditPressed, dahPressed);
   }
-  if (netMode) {
-    if (udp.begin(port) == 0) { playStr("NO PORT", SPKR); }
-    else if (netMode == netClient) { playChar('C', SPKR); }
-         else { playChar('S', SPKR); }
-  } else { playChar('R', SPKR); }
+  hostPlayNext();
+
+  uint8_t status = wkStatus;
+  if (hostSender.busy || hostLength) { status |= wkStatusBusy; }
+  if (hostLength - hostPlay > (int) sizeof(hostText) * 2 / 3) { status |= wkStatusXoff; }
+  if (hostBreakIn) { status |= wkStatusBreakIn; }
+  if (straightDown) { status |= wkStatusKeyDown; }
+  if (hostSender.busy && !hostSender.code.length && hostSender.gap == 0) { status |= wkStatusWait; }
+  if (hostOpen && status != hostStatus) { hostReply(status); }
+  hostStatus = status;
 }
 
 
-// SYMBOL AQUISITION FUNCTIONS
+// BEEPS
+// Tones and LED blinks that confirm something, played a step at a time from loop(). A
+// run of them ends with a silent step.
 
-void sendPacket(unsigned int sendData, unsigned long spacing) {
+void beepAdd(unsigned int tone, int led, unsigned int length) {
+  if (beepNext == beepCount) {
+    beepCount = 0;
+    beepNext = 0;
+  }
+  if (beepCount == (int) (sizeof(beeps) / sizeof(beeps[0]))) { return; }
+  Beep beep = { (uint16_t) tone, (uint8_t) led, (uint16_t) length };
+  beeps[beepCount++] = beep;
+}
 
-  char frame[10];
 
-  packetCount++;
-  packet.number = (spacing << 16) + packetCount;
-  packet.data = sendData;
-  memcpy(frame, &packet, sizeof(packet));
-  udp.beginPacket(host, port);
-  delay(0);
-  udp.write(frame, sizeof(packet));
-  delay(0);
-  udp.endPacket();
-  delay(50);
-  lastPacketSentTime = millis();
-  DEBUG_PRINT("Packet Sent: ");
-  DEBUG_PRINTLN(packetCount);
+void beepService() {
+  if (beepNext == beepCount || (long) (millis() - beepUntil) < 0) { return; }
+  const Beep &beep = beeps[beepNext++];
+  outputTone(beep.tone);
+  digitalWrite(pinStatusLed, beep.led ? HIGH : LOW);
+  beepUntil = millis() + beep.length;
 }
 
 
-// Takes the current state of the paddles and does the right thing with it. Handles element
-// comnpletion, passes along TX state, and memory location for recording.
-void processPaddles(int ditPressed, int dahPressed, int transmit, int memoryId) {
+// MEMORY RECORDING FUNCTIONS
 
-  if (ditDetected) {                                                    // Insert Dit detected during
-    playSym(symDit, transmit, memoryId, 0);                             // Dah play.
+// Record a code in the memory being set.
+void memRecord(int value) {
+  memories.record(value);
+}
+
+
+// Start recording a memory. Three dahs say the recording has started; the paddles are
+// keyed on the sidetone and recorded in stateRecording until the Setup button is pressed.
+void recordStart(int memoryId) {
+  if (!memories.startRecord(memoryId)) { return; }
+  recordSlot = memoryId;
+  senderStop(announcer);
+  announceText[0] = 0;
+  announce("O");
+  recording = 2;
+  currState = stateRecording;
+}
+
+
+// Finish the recording, and confirm it with tones and a blink of the LED for each
+// memory number.
+void recordEnd() {
+  memories.endRecord();
+  recording = 0;
+  currState = stateIdle;
+
+  beepAdd(1300, 0, 300);
+  beepAdd(900, 0, 300);
+  for (int i = 0; i <= recordSlot; i++) {
+    beepAdd(2000, 1, 150);
+    beepAdd(2000, 0, 150);
+  }
+  beepAdd(0, 0, 0);
+}
+
+
+// Record the spaces between the elements, and key the paddles, until the Setup button
+// is pressed or the memory is full.
+void recordService(int ditPressed, int dahPressed) {
+  if ((ditPressed || dahPressed) && keyerState == keyerIdle && (millis() - lastSymPlayedTime > timing.ditMillis())) {
+    // record a space;
+
+    if (recording == 2) {
+      recording = 1;
+    } else {
+      double spaceDuration = (millis() - lastSymPlayedTime) * 3000.0 / timing.unit();
+      spaceDuration += 2.5;
+      int toRecord = spaceDuration;
+      if (toRecord > 255) { toRecord = 255; }
+      memRecord(toRecord);
+    }
+  }
+
+  processPaddles(ditPressed, dahPressed, SPKR);
+
+  if (setupRead() || memories.full()) { recordEnd(); }
+}
+
+
+// MEMORY PLAYER
+// A memory is played from loop() like the other senders: an element is started each time
+// the keyer engine comes free, and the recorded spaces move the due time on. The next
+// chunk of the memory is read in while an element keys, so the read never holds up the
+// element after. A client plays it as text instead (see memoryTextService()).
+
+// Client mode - read the next piece of the memory as text, as much as fits in a frame, into
+// memoryText. The recording is read back into characters, a space of memoryWordCode or more
+// making a word space. A code that is no character goes as its elements run together,
+// written as E and T. Returns the length.
+int memoryReadText() {
+  int length = 0;
+
+  while (!memoryEnded) {
+    int cmd = (memoryHeld != memoryNone) ? memoryHeld : memories.next();
+    memoryHeld = memoryNone;
+    int element = (cmd == 0 || cmd == 1);
+    if (element && memoryCode.length < morseMaxElements) {
+      memoryCode = morseMerge(memoryCode, morseTable[cmd ? 'T' : 'E']);
+      continue;
+    }
+
+    char c = morseDecode(memoryCode);
+    int need = c ? 1 : (memoryCode.length ? memoryCode.length + 2 : 0);
+    int space = (cmd >= memoryWordCode);
+    if (length + need + space > wireMaxText) {                          // For the next piece
+      memoryHeld = cmd;
+      break;
+    }
+    if (c) { memoryText[length++] = c; }
+    else if (memoryCode.length) {
+      memoryText[length++] = '<';
+      for (int i = 0; i < memoryCode.length; i++) { memoryText[length++] = morseElementAt(memoryCode, i) ? 'T' : 'E'; }
+      memoryText[length++] = '>';
+    }
+    if (space) { memoryText[length++] = ' '; }
+    memoryCode = element ? morseTable[cmd ? 'T' : 'E'] : MorseCode { 0, 0, 0 };
+    if (cmd == -1) { memoryEnded = 1; }
+  }
+  memoryText[length] = 0;
+  memoryTextNext = 0;
+  return length;
+}
+
+
+// Client mode - play the memory here on the sidetone, and send it to the server a piece at
+// a time, each as it starts to play here.
+void memoryTextService() {
+  if (!senderService(memorySender)) { return; }
+  if (!memoryText[memoryTextNext]) {
+    if (!memoryReadText()) {                                            // All played
+      memoryTextSent = 0;
+      memoryStop();
+      return;
+    }
+    uint32_t now = micros();
+    if ((int32_t) (memorySender.at - now) < 0) { memorySender.at = now; }
+    sendText(memoryText, strlen(memoryText), millisAt(memorySender.at));
+    memoryTextSent = 1;
+  }
+
+  char c = memoryText[memoryTextNext++];
+  if (senderText(memorySender, c, memoryProsign, memoryMerge)) { senderService(memorySender); }
+}
+
+
+// Key the next element of the memory when it is due. Build packet if needed.
+void memoryElementService() {
+  if (keyerState != keyerIdle) { return; }
+  if ((int32_t) (memoryAt - micros()) > (int32_t) keyerLead) { return; }
+
+  int cmd = memories.next();
+  DEBUG_PRINT("cmd: ");
+  DEBUG_PRINTLN(cmd);
+  if (cmd == -1) {                        // End of the memory: send the last char
+    if (!streamElements) { sendChar(); }
+    memoryStop();
+    return;
+  }
+  if (cmd == 0 || cmd == 1) {
+    if ((int32_t) (memoryAt - keyerNext) > 0) { keyerNext = memoryAt; }
+    keyerStart(cmd+1, TX);
+    memoryAt = keyerUntil + timing.space();
+  } else if (cmd > 4) {
+    if (!streamElements) { sendChar(); }
+    memoryAt += (cmd - 4) * timing.unit() / 3;
+  }
+  memories.fill();
+}
+
+
+// Play a memory. Returns at once, memoryService() plays it. A memory that is not there
+// gets an error beep.
+void playMemory(int memoryId) {
+  memoryStop();
+  if (!memories.startPlay(memoryId)) {
+    beepAdd(800, 0, 200);
+    beepAdd(500, 0, 300);
+    beepAdd(0, 0, 0);
+    return;
+  }
+  memoryPlaying = 1;
+  memoryAt = micros();
+  memoryAsText = sendsText();
+  if (memoryAsText) {
+    memoryHeld = memoryNone;
+    memoryEnded = 0;
+    memoryCode = morseTable[0];
+    memoryText[0] = 0;
+    memoryTextNext = 0;
+    memoryTextSent = 0;
+    memoryProsign = 0;
+    memorySender.at = memoryAt;
+  } else {
+    wireClear(toSend, wireChar);
+  }
+}
+
+
+// Stop the memory playing. If the server was sent some of it, it is told to stop too.
+void memoryStop() {
+  if (!memoryPlaying) { return; }
+  if (memoryAsText) {
+    senderStop(memorySender);
+    if (memoryTextSent) { sendText(NULL, 0, millis()); }
+  } else if (keyerState != keyerIdle && keyerTransmit) {
+    keyerAbort();
     ditDetected = 0;
-    playAlternate = 0;
-    ditPressed = 0;
   }
-  if (currKeyerMode == keyerModeIambic && ditPressed && dahPressed) {   // Both paddles
-    if (prevSymbol == symDah) { playSym(symDit, transmit, memoryId, 0); }
-    else playSym(symDah, transmit, memoryId, 1);
-    if (iambicModeB) { playAlternate = 1; }                             // Trigger element cpmpletion.
-  } else if (dahPressed && currKeyerMode != keyerModeStraight) {        // Dah paddle
-    if (currKeyerMode == keyerModeIambic) {
-      playSym(symDah, transmit, memoryId, 1);
-    } else if (currKeyerMode == keyerModeVibroplex) {
-      playStraightKey(pinKeyDah);
+  memories.stopPlay();
+  memoryPlaying = 0;
+}
+
+
+// Play the memory, from loop(). The paddles, a straight key and the host take over from it.
+void memoryService(int ditPressed, int dahPressed) {
+  if (!memoryPlaying) { return; }
+  if (ditPressed || dahPressed || straightDown || hostSender.busy) {
+    memoryStop();
+    paddleTakeOver(ditPressed, dahPressed);
+    return;
+  }
+  if (memoryAsText) { memoryTextService(); }
+  else { memoryElementService(); }
+}
+
+
+// PADDLE ADJUSTMENT INPUT FUNCTIONS
+// These are used to adjust program parameters via the paddles.
+
+int scaleDown(int orig, double factor, int lowerLimit) {
+  int scaled = (int)((double)orig * factor);
+  if (scaled == orig) { scaled--; }
+  if (scaled < lowerLimit) { scaled = lowerLimit; }
+  return scaled;
+}
+
+
+int scaleUp(int orig, double factor, int upperLimit) {
+  int scaled = (int)((double)orig * factor);
+  if (scaled == orig) { scaled++; }
+  if (scaled > upperLimit) { scaled = upperLimit; }
+  return scaled;
+}
+
+
+// Leave a setting mode, and write out what changed.
+void settingLeave(uint8_t setting) {
+  senderStop(announcer);
+  announceText[0] = 0;
+  paddleTakeOver(1, 1);
+  if (setting) { settingsChanged(setting); }
+  settingsFlush();
+  currState = stateIdle;
+}
+
+
+// Key dits at the speed and tone being set, while there is nothing to announce.
+void settingDit() {
+  keyerService();
+  if (keyerState == keyerIdle && !announcer.busy && !announceText[0]) { keyerStart(symDit, SPKR); }
+}
+
+
+// Speed setting mode: each press of the dit paddle is a WPM up, and of the dah paddle one
+// down. The new speed is announced, and another press cuts the announcement short.
+void speedService(int ditPressed, int dahPressed) {
+  if (setupRead()) {
+    settingLeave(settingSpeed);
+    return;
+  }
+
+  int pressed = ditPressed || dahPressed;
+  if (pressed && !settingHeld) {
+    if (ditPressed && timing.wpm() < timingMaxWpm) { timing.setSpeed((timing.wpm() + 1) * 10); }
+    if (dahPressed && timing.wpm() > timingMinWpm) { timing.setSpeed((timing.wpm() - 1) * 10); }
+    hostSpeed = timing.speed();
+    char speed[8];
+    itoa(timing.wpm(), speed, 10);
+    senderStop(announcer);
+    announceText[0] = 0;
+    announce(speed);
+  }
+  paddleTakeOver(ditPressed, dahPressed);
+  settingHeld = pressed;
+  settingDit();
+}
+
+
+// Tone setting mode: the dit paddle lowers the tone, and the dah paddle raises it, a step
+// a dit.
+void toneService(int ditPressed, int dahPressed) {
+  if (setupRead()) {
+    settingLeave(0);
+    return;
+  }
+
+  paddleTakeOver(ditPressed, dahPressed);
+  keyerService();
+  if (keyerState != keyerIdle || announcer.busy || announceText[0]) { return; }
+  if (ditPressed) { toneFreq = scaleDown(toneFreq, 1/1.1, 30); }
+  if (dahPressed) { toneFreq = scaleUp(toneFreq, 1.1, 12500); }
+  if (ditPressed || dahPressed) { settingsChanged(settingFreq); }
+  settingDit();
+}
+
+
+// SWITCHES
+// The Setup button and the memory switches are read on every pass of loop(), and what
+// a press does is worked out from its edges, so nothing waits for a switch to be let go.
+
+// Read the Setup button. A change within switchDebounce millis of the last is taken as
+// bounce. Returns 1 on the pass it is pressed.
+int setupRead() {
+  int down = digitalRead(pinSetup) == LOW;
+  if (down == setupDown || millis() - setupChangedAt < switchDebounce) { return 0; }
+  setupDown = down;
+  setupChangedAt = millis();
+  return down;
+}
+
+
+// Page setting mode: the memory switches play and record the slots of one page at a
+// time. Each press of the dit paddle is a page up, and of the dah paddle one down, and
+// the page is announced, from 1.
+void pageService(int ditPressed, int dahPressed) {
+  if (setupRead()) {
+    settingLeave(settingPage);
+    return;
+  }
+
+  int pressed = ditPressed || dahPressed;
+  if (pressed && !settingHeld) {
+    if (ditPressed && memoryPage < memoryPages - 1) { memoryPage++; }
+    if (dahPressed && memoryPage > 0) { memoryPage--; }
+    char page[8];
+    itoa(memoryPage + 1, page, 10);
+    senderStop(announcer);
+    announceText[0] = 0;
+    announce(page);
+  }
+  paddleTakeOver(ditPressed, dahPressed);
+  settingHeld = pressed;
+}
+
+
+// Idle state - a short press of the Setup button enters the speed setting mode, a long
+// press the tone setting mode, and one twice as long the memory page setting mode, once it
+// is let go. Pressing a memory switch while it is held sets the keyer mode instead:
+// 1 iambic, 2 straight key, 3 vibroplex.
+void setupService() {
+  static const int modes[] = { keyerModeIambic, keyerModeStraight, keyerModeVibroplex };
+  static const char *const modeNames[] = { "I", "S", "V" };
+
+  if (setupRead()) {
+    setupNext = stateSettingSpeed;
+    setupPressedAt = millis();
+  }
+  if (setupNext < 0) { return; }
+
+  if (!setupDown) {                                                     // Let go
+    if (setupNext != stateIdle) {
+      memoryStop();
+      settingHeld = 0;
+      digitalWrite(pinStatusLed, LOW);
+    }
+    currState = setupNext;
+    setupNext = -1;
+    return;
+  }
+  if (setupNext == stateSettingSpeed && millis() - setupPressedAt > switchLong) {
+    setupNext = stateSettingTone;
+    announce("TONE");
+  }
+  if (setupNext == stateSettingTone && millis() - setupPressedAt > 2 * switchLong) {
+    setupNext = stateSettingPage;
+    announce("PAGE");
+  }
+  int mode = readAnalog();
+  if (setupNext != stateIdle && mode >= 1 && mode <= 3) {
+    currKeyerMode = modes[mode - 1];
+    announce(modeNames[mode - 1]);
+    settingsChanged(settingMode);
+    settingsFlush();
+    setupNext = stateIdle;
+  }
+}
+
+
+// Idle state - a short press of a memory switch plays the memory, and a long one records
+// it, once the switch is let go. Four dits say it has been held long enough to record.
+void memoryButtonService() {
+  int button = readAnalog();
+  int last = memSwitch;
+  memSwitch = button;
+
+  if (!memoryButton) {
+    if (button && !last && setupNext < 0) {
+      memoryButton = button;
+      memoryButtonAt = millis();
+      memoryButtonLong = 0;
     }
+    return;
+  }
+  if (button == memoryButton) {
+    if (!memoryButtonLong && millis() - memoryButtonAt > switchLong) {
+      memoryButtonLong = 1;
+      announce("E E E E");
+    }
+    return;
+  }
+
+  digitalWrite(pinStatusLed, LOW);
+  int slot = memoryPage * memoryButtons + memoryButton - 1;
+  if (memoryButtonLong) {
+    memoryStop();
+    recordStart(slot);
+  } else {
+    playMemory(slot);
+  }
+  memoryButton = 0;
+}
+
+
+// INITIALIZATION FUNCTIONS
+
+void factoryReset() {
+  EEPROMr.write(3, storageMagic1);
+  EEPROMr.write(4, storageMagic2);
+  EEPROMr.write(5, packetTypeEnd);
+  EEPROMr.commit();
+
+  currStorageOffset = 5;
+
+  outputTone(900);
+  delay(300);
+  outputTone(600);
+  delay(300);
+  outputTone(1500);
+  delay(900);
+  outputTone(0);
+}
+
+
+// Copy the memories out of storage in the bare layout (storageMagicBare) to LittleFS,
+// before the factory reset that upgrades it wipes them. Its records have no length or
+// CRC: the type, then 2 bytes for the speed and the tone, nothing for a mode, and for a
+// memory a 2 byte length and the codes, which are the ones MemoryBank keeps. A later
+// record of a memory replaces an earlier one. Anything else ends the log.
+void migrateMemories() {
+  int offset = 5;
+
+  while (offset < storageSize) {
+    int packetType = EEPROMr.read(offset);
+    if (packetType == packetTypeSpeed || packetType == packetTypeFreq) {
+      offset += 3;
+    } else if (packetType >= packetTypeKeyerModeIambic && packetType <= packetTypeKeyerModeStraight) {
+      offset += 1;
+    } else if (packetType >= packetTypeMem0 && packetType <= packetTypeMem2) {
+      size_t length = (EEPROMr.read(offset+1) << 8) | EEPROMr.read(offset+2);
+      if (offset + 3 + length > (size_t) storageSize) { break; }
+      if (memories.startRecord(packetType - packetTypeMem0)) {
+        for (size_t i = 0; i < length; i++) { memories.record(EEPROMr.read(offset + 3 + i)); }
+        memories.endRecord();
+      }
+      offset += 3 + length;
+    } else {
+      break;
+    }
+  }
+}
+
+
+void loadStorage() {
+  // Reset the configuration byng both paddles while the keyer is started.
+  // Memory layout:
+  // Bytes 0, 2, 1 : Reserved for rotation library signature.
+  // Bytes 3, 4 : Reserved for magic numbers.
+  // Bytes 5 - 1024 : memory packets.
+
+  int resetRequested = (digitalRead(pinKeyDit) == LOW) && (digitalRead(pinKeyDah) == LOW);
+
+  if (!resetRequested && EEPROMr.read(3) == storageMagic1 && EEPROMr.read(4) == storageMagicBare) { migrateMemories(); }
+  if (resetRequested || EEPROMr.read(3) != storageMagic1 || EEPROMr.read(4) != storageMagic2) { factoryReset(); }
+
+  currStorageOffset = 5;
+
+  while (currStorageOffset + 4 <= storageSize) {
+    int packetType = EEPROMr.read(currStorageOffset);
+    if (packetType == packetTypeEnd) { break; }
+    size_t length = (EEPROMr.read(currStorageOffset+1) << 8) | EEPROMr.read(currStorageOffset+2);
+    if (currStorageOffset + 4 + length > (size_t) storageSize) { break; }
+
+    uint8_t crc = 0;
+    for (size_t i = 0; i < 3 + length; i++) { crc = storageCrc(crc, EEPROMr.read(currStorageOffset + i)); }
+    if (crc != EEPROMr.read(currStorageOffset + 3 + length)) { break; }   // Torn write, the log ends here
+
+    int payload = currStorageOffset + 3;
+    if (packetType == packetTypeWpm && length == 2) {
+      timing.setSpeed((EEPROMr.read(payload) << 8) | EEPROMr.read(payload+1));
+    } else if (packetType == packetTypeSpeed && length == 2) {
+      int dit = (EEPROMr.read(payload) << 8) | EEPROMr.read(payload+1);
+      if (dit) { timing.setSpeed((12000 + dit / 2) / dit); }
+    } else if (packetType == packetTypeFreq && length == 2) {
+      toneFreq = (EEPROMr.read(payload) << 8) | EEPROMr.read(payload+1);
+    } else if (packetType == packetTypeKeyerModeIambic) {
+      currKeyerMode = keyerModeIambic;
+    } else if (packetType == packetTypeKeyerModeVibroplex) {
+      currKeyerMode = keyerModeVibroplex;
+    } else if (packetType == packetTypeKeyerModeStraight) {
+      currKeyerMode = keyerModeStraight;
+    } else if (packetType >= packetTypeMem0 && packetType <= packetTypeMem2) {
+      int memoryId = packetType - packetTypeMem0;                          // Memories are on LittleFS
+      if (!memories.size(memoryId) && memories.startRecord(memoryId)) {     // now, move any left here.
+        for (size_t i = 0; i < length; i++) { memories.record(EEPROMr.read(payload + i)); }
+        memories.endRecord();
+      }
+    } else if (packetType == packetTypePage && length == 1) {
+      int page = EEPROMr.read(payload);
+      if (page < memoryPages) { memoryPage = page; }
+    } else if (packetType == packetTypeWifi && length == sizeof(wifiCache)) {
+      uint8_t *cache = (uint8_t *) &wifiCache;
+      for (size_t i = 0; i < length; i++) { cache[i] = EEPROMr.read(payload + i); }
+      wifiCached = 1;
+    }
+
+    currStorageOffset += 4 + length;
+  }
+}
+
+
+// Report on the serial port how long from power-on something took, unless it speaks the
+// WinKeyer protocol.
+void reportTime(const char *what) {
+  if (!serialText) { return; }
+  Serial.print(what);
+  Serial.print(" at ");
+  Serial.print(millis());
+  Serial.println(" ms");
+}
+
+
+// Start joining the WiFi network, in the background. With the access point cached
+// from the last boot, the scan is skipped, and with cacheAddress the DHCP exchange too.
+void networkBegin() {
+  session = ESP.random();                 // The peer starts its receive window over on a new one
+  WiFi.setSleepMode(WIFI_NONE_SLEEP);
+  linkCached = wifiCached;
+  if (linkCached) {
+    if (cacheAddress && wifiCache.ip[0]) {
+      WiFi.config(IPAddress(wifiCache.ip[0], wifiCache.ip[1], wifiCache.ip[2], wifiCache.ip[3]),
+                  IPAddress(wifiCache.gateway[0], wifiCache.gateway[1], wifiCache.gateway[2], wifiCache.gateway[3]),
+                  IPAddress(wifiCache.subnet[0], wifiCache.subnet[1], wifiCache.subnet[2], wifiCache.subnet[3]));
+    }
+    WiFi.begin(ssid, password, wifiCache.channel, wifiCache.bssid);
+  } else {
+    WiFi.begin(ssid, password);
+  }
+  linkState = linkJoining;
+  linkStartedAt = millis();
+}
+
+
+// Called from loop() until the link is up. If the cached access point does not answer
+// in time, join again with a scan. Once up, the access point is cached for next time,
+// and the UDP port is opened.
+void networkService() {
+  if (linkState != linkJoining) { return; }
+
+  if (WiFi.status() != WL_CONNECTED) {
+    if (linkCached && millis() - linkStartedAt > wifiCachedTimeout) {
+      DEBUG_PRINTLN("Cached access point not found, scanning");
+      WiFi.config(IPAddress(), IPAddress(), IPAddress());
+      WiFi.begin(ssid, password);
+      linkCached = 0;
+      linkStartedAt = millis();
+    }
+    return;
+  }
+
+  linkState = linkUp;
+  reportTime("WiFi up");
+  DEBUG_PRINT("WiFi connected with IP: ");
+  DEBUG_PRINTLN(WiFi.localIP());
+
+  WifiCache joined;
+  IPAddress ip = WiFi.localIP();
+  IPAddress gateway = WiFi.gatewayIP();
+  IPAddress subnet = WiFi.subnetMask();
+  memcpy(joined.bssid, WiFi.BSSID(), sizeof(joined.bssid));
+  joined.channel = WiFi.channel();
+  for (int i = 0; i < 4; i++) {
+    joined.ip[i] = ip[i];
+    joined.gateway[i] = gateway[i];
+    joined.subnet[i] = subnet[i];
+  }
+  if (!wifiCached || memcmp(&joined, &wifiCache, sizeof(joined))) {
+    wifiCache = joined;
+    wifiCached = 1;
+    settingsChanged(settingWifi);
+  }
+
+  if (!monitorBegin()) { announce("NO PORT"); }
+  else if (netMode == netClient) { announce("C"); }
+  else { announce("S"); }
+}
+
+
+void setup() {
+#ifdef WINKEYER
+  Serial.begin(1200);
+#else
+  Serial.begin(115200);
+#endif
+
+  pinMode(pinSetup, INPUT_PULLUP);
+  pinMode(pinKeyDit, INPUT_PULLUP);
+  pinMode(pinKeyDah, INPUT_PULLUP);
+  
+  pinMode(D1, OUTPUT);
+  digitalWrite(D1, LOW);
+  pinMode(D2, OUTPUT);
+  digitalWrite(D2, LOW);
+  pinMode(D3, OUTPUT);
+  digitalWrite(D3, LOW); 
+  pinMode(pinStatusLed, OUTPUT);
+  pinMode(pinMosfet, OUTPUT);
+  pinMode(pinSpeaker, OUTPUT);
+  outputBegin();
+  paddleBegin();
+  EEPROMr.size(4);                      // Create 4 memory blocks for rotation. Adjust for memory size.
+  EEPROMr.begin(storageSize);
+  memories.begin();
+  loadStorage();
+  hostSpeed = timing.speed();
+
+  char speed[8];
+  itoa(timing.wpm(), speed, 10);
+  announce(speed);
+
+#ifdef CLIENT
+  netMode = netClient;
+#elif SERVER
+  netMode = netServer;
+#else
+  netMode = readAnalog();
+#endif
+
+  if (netMode == netClient || netMode == netServer) { networkBegin(); }
+  else { announce("R"); }
+  if (netMode == netServer && monitorHost[0]) {
+    playoutTransmit = SPKR;
+    remoteSender.transmit = SPKR;
+  }
+
+  reportTime("Ready to key");
+}
+
+
+// SYMBOL AQUISITION FUNCTIONS
+
+// Queue a datagram for the peer. If the sends have fallen that far behind, the oldest
+// waiting is dropped; a run frame carries copies of the ones before it anyway.
+void udpWrite(const char *frame, size_t size) {
+
+  if (linkState != linkUp) { return; }
+
+  outgoing.push((const uint8_t *) frame, size);
+}
+
+
+// Send the oldest queued datagram to the peer. One a pass, so loop() never waits on more
+// than a single send.
+void udpService() {
+  const uint8_t *data;
+  size_t size;
+
+  if (outgoing.isEmpty()) { return; }
+  if (linkState != linkUp) {
+    outgoing.shift();
+    return;
+  }
+  data = outgoing.first(size);
+  udp.beginPacket(host, port);
+  udp.write(data, size);
+  udp.endPacket();
+  outgoing.shift();
+}
+
+
+// Put copies of the last few frames sent after the frame at the start of a datagram,
+// newest first, as far as they fit. Returns the new size.
+size_t fecAppend(uint8_t *buffer, size_t size, unsigned long now) {
+  for (int i = 1; i <= fecRedundancy && i <= wireMaxRedundancy; i++) {
+    SentFrame &old = sentFrames[(sentNext + wireMaxRedundancy - i) % wireMaxRedundancy];
+    if (!old.size || now - old.at > fecWindow) { break; }
+    size_t pos = wirePutVarint(buffer, size, wireMaxDatagram, old.size);
+    if (!pos || pos + old.size > wireMaxDatagram) { break; }
+    memcpy(buffer + pos, old.bytes, old.size);
+    size = pos + old.size;
+  }
+  return size;
+}
+
+
+// Encode and send a frame, numbering it.
+void sendFrame(WireFrame &frame) {
+
+  uint8_t buffer[wireMaxDatagram];
+  unsigned long now = millis();
+
+  // The sequence is only taken once the frame is known to fit, so a frame that is
+  // never sent does not show up at the peer as a lost one.
+  frame.sequence = packetCount + 1;
+  frame.session = session;
+  size_t size = wireEncode(frame, buffer, wireMaxSize);
+  if (!size) { return; }
+  packetCount++;
+
+  // Every frame carries copies of the last few, so one lost datagram costs nothing as long
+  // as the next one gets through. Keepalives and acks too, or a lost one would leave a
+  // gap that holds up the frames after it.
+  size_t primary = size;
+  size = fecAppend(buffer, size, now);
+  SentFrame &slot = sentFrames[sentNext];
+  slot.at = now;
+  slot.size = primary;
+  memcpy(slot.bytes, buffer, primary);
+  sentNext = (sentNext + 1) % wireMaxRedundancy;
+
+  udpWrite((const char *) buffer, size);
+  stats.count(statFramesSent);
+  lastPacketSentTime = now;
+  int stream = (frame.type == wireChar || frame.type == wireElement || frame.type == wireEdge || frame.type == wireText);
+  repeatsPending = stream ? fecRepeats : 0;
+  repeatAt = now;
+}
+
+
+// Send a repeat: copies of the last frames, with no new frame. Its sequence number is
+// the newest frame's, which it does not take again.
+void repeatService() {
+  if ((!repeatsPending && !repeatHeld) || millis() - repeatAt < fecRepeat) { return; }
+  if (repeatsPending) { repeatsPending--; }
+  repeatAt = millis();
+
+  uint8_t buffer[wireMaxDatagram];
+  WireFrame frame;
+  wireClear(frame, wireRepeat);
+  frame.sequence = packetCount;
+  frame.session = session;
+  size_t size = wireEncode(frame, buffer, wireMaxSize);
+  size_t copies = fecAppend(buffer, size, millis());
+  if (copies > size) { udpWrite((const char *) buffer, copies); }
+}
+
+
+// Client mode - the timing settings, as they go to the server with runs, text and
+// keepalives, so it keys at the same speed, weighting, ratio and Farnsworth.
+WireTiming wireTiming() {
+  WireTiming t = { (uint16_t) timing.speed(), (uint8_t) timing.weight(), (uint8_t) timing.ratio(),
+                   (uint8_t) timing.farnsworth() };
+  return t;
+}
+
+
+// Send the character assembled in toSend. Once the clock is synchronized, the frame also
+// carries the server time the character started.
+void sendChar() {
+
+  if (!toSend.length) { return; }
+
+  toSend.timing = wireTiming();
+  if (clockSync.synced()) {
+    toSend.stamped = 1;
+    toSend.stamp = clockSync.toServer(charStart);
+  }
+  sendFrame(toSend);
+  lastPacketType = wireChar;
+  DEBUG_PRINT("Packet Sent: ");
+  DEBUG_PRINTLN(packetCount);
+  wireClear(toSend, wireChar);
+}
+
+
+// Client mode - send a keepalive, carrying the speed and the send time for clock sync.
+void sendKeepAlive() {
+
+  WireFrame keepAlive;
+
+  wireClear(keepAlive, wireKeepAlive);
+  keepAlive.timing = wireTiming();
+  keepAlive.t1 = millis();
+  sendFrame(keepAlive);
+}
+
+
+// Server mode - answer a keepalive, returning its send time with ours.
+void sendAck(uint32_t t1, unsigned long received) {
+
+  WireFrame ack;
+
+  wireClear(ack, wireAck);
+  ack.t1 = t1;
+  ack.t2 = received;
+  ack.t3 = millis();
+  sendFrame(ack);
+}
+
+
+// Stream one element as it starts, while the element is being keyed.
+void sendElement(int sym, unsigned long when) {
+
+  WireFrame element;
+
+  wireClear(element, wireElement);
+  element.gap = when - lastMarkEnd;
+  element.timing = wireTiming();
+  wireAppend(element, sym == symDah);
+  if (clockSync.synced()) {
+    element.stamped = 1;
+    element.stamp = clockSync.toServer(when);
+  }
+  sendFrame(element);
+  DEBUG_PRINT("Element Sent: ");
+  DEBUG_PRINTLN(packetCount);
+}
+
+
+// Stream a key edge as it happens, for manual keying. When the length of the mark is
+// known up front (a vibroplex dit), the key-up goes in the same frame. Times are sent
+// as spans from the edge before, and edgeLastSent follows them as the server will add
+// them up, so rounding does not build up. A key-down with no key-up yet is repeated for
+// as long as the key is held, so it still gets there inside the mark when the frame and
+// its first repeats are lost.
+void sendEdges(int down, uint32_t at, uint32_t mark) {
+
+  WireFrame frame;
+
+  wireClear(frame, wireEdge);
+  frame.down = down;
+  uint32_t span = (at - edgeLastSent) / wireEdgeUnit;
+  if (span > edgeMaxSpan) {
+    span = edgeMaxSpan;
+    edgeLastSent = at;
+  } else {
+    edgeLastSent += span * wireEdgeUnit;
+  }
+  wireAppendEdge(frame, span);
+  if (mark) {
+    wireAppendEdge(frame, mark / wireEdgeUnit);
+    edgeLastSent += mark / wireEdgeUnit * wireEdgeUnit;
+  }
+  if (clockSync.synced()) {
+    frame.stamped = 1;
+    frame.stamp = clockSync.toServer(millis() + (int32_t) (at - micros()) / 1000);
+  }
+  sendFrame(frame);
+  repeatHeld = down && !mark;
+}
+
+
+// Client mode - canned text, memories and host messages, goes to the server as text for
+// it to key with its own timing, rather than being keyed here and streamed.
+int sendsText() {
+  return netMode == netClient && linkState == linkUp;
+}
+
+
+// Send text for the server to key, from a time. No text cancels what it has still to play.
+void sendText(const char *text, int length, unsigned long when) {
+
+  WireFrame frame;
+
+  wireClear(frame, wireText);
+  frame.timing = wireTiming();
+  frame.length = length;
+  if (length) { memcpy(frame.text, text, length); }
+  if (clockSync.synced()) {
+    frame.stamped = 1;
+    frame.stamp = clockSync.toServer(when);
+  }
+  sendFrame(frame);
+  lastPacketType = wireText;
+}
+
+
+// Start a symbol from the paddles, recording it if a memory is being set.
+void keyerPlay(int sym, int transmit, int toRecord) {
+  keyerStart(sym, transmit);
+  if (recording) { memRecord(toRecord); }
+}
+
+
+// Takes the current state of the paddles and does the right thing with it. Handles element
+// comnpletion, and passes along TX state.
+// Never blocks: a new element is only started once the keyer engine is idle.
+void processPaddles(int ditPressed, int dahPressed, int transmit) {
+
+  keyerService();
+
+  if (currKeyerMode == keyerModeStraight) {                             // Straight key follows
+    keyerManual(ditPressed, transmit, paddleTime(ditPaddle));           // the dit paddle.
+    return;
+  }
+  if (keyerState != keyerIdle) { return; }
+  if (ditPaddle.takePress()) { ditPressed = 1; }                        // Presses made during the
+  if (dahPaddle.takePress()) { dahPressed = 1; }                        // element just ended.
+  if (currKeyerMode == keyerModeVibroplex && (dahPressed || straightDown)) {
+    keyerManual(dahPressed, transmit, paddleTime(dahPaddle));           // Vibroplex dah side.
+    return;
+  }
+
+  if (ditDetected) {                                                    // Insert Dit detected during
+    keyerPlay(symDit, transmit, 0);                                     // Dah play.
+    ditDetected = 0;
+    playAlternate = iambicModeB && dahPressed && ditPaddle.closed();    // Still squeezed.
+    ditPressed = 0;
+  } else if (currKeyerMode == keyerModeIambic && ditPressed && dahPressed) {   // Both paddles
+    if (prevSymbol == symDah) { keyerPlay(symDit, transmit, 0); }
+    else keyerPlay(symDah, transmit, 1);
+    if (iambicModeB) { playAlternate = 1; }                             // Trigger element cpmpletion.
+  } else if (dahPressed && currKeyerMode == keyerModeIambic) {          // Dah paddle
+    keyerPlay(symDah, transmit, 1);
   } else if (ditPressed) {                                              // Dit paddle
     if (prevSymbol == symDit) { ditDetected = 0; }
-    if (currKeyerMode == keyerModeStraight) { playStraightKey(pinKeyDit); }
-    else { playSym(symDit, transmit, memoryId, 0); }
-  } else {                                                              // No Paddle
-    if (playAlternate) {                                                // Handle element completion.
-      if (prevSymbol == symDah) { playSym(symDit, transmit, memoryId, 0); }
-      else { playSym(symDah, transmit, memoryId, 1); }
-      playAlternate = 0;
-    }
+    keyerPlay(symDit, transmit, 0);
+  } else if (playAlternate) {                                           // No Paddle
+    if (prevSymbol == symDah) { keyerPlay(symDit, transmit, 0); }  // Handle element completion.
+    else { keyerPlay(symDah, transmit, 1); }
+    playAlternate = 0;
+  } else {
     // If a character packet is ready and the timing is okay, send it.
-    if (toChar && (netMode == netClient) && (millis() - lastSymPlayedTime > ditMillis)) {
-      toChar = toChar << (16 - (toLength * 2));
-      toSend = (toLength << 16) + toChar;
-      sendPacket(toSend, gap);
-      lastPacketType = udpFrame;
-      toSend = 0;
-      toChar = 0;
-      toLength = 0;
+    if (toSend.length && (netMode == netClient) && (millis() - lastSymPlayedTime > timing.ditMillis())) {
+      sendChar();
     }
     prevSymbol = 0;
   }
-  // If we have 8 elements stacked in the packet, send it!
-  if (toLength == 8) {
-    toChar = toChar << (16 - (toLength * 2));
-    toSend = (toLength << 16) + toChar;
-    sendPacket(toSend, gap);
-    lastPacketType = udpFrame;
-    toSend = 0;
-    toChar = 0;
-    toLength = 0;
+  // If the frame is full, send it!
+  if (toSend.length == wireMaxElements) { sendChar(); }
+}
+
+
+// Server mode - key at the timing a remote sender gave.
+void takeTiming(const WireTiming &t) {
+  timing.set(t.speed, t.weight, t.ratio, t.farnsworth);
+}
+
+
+// Server mode - the timing table a remote sender keys at, to lay its runs out with.
+KeyTiming remoteTiming(const WireTiming &t) {
+  KeyTiming table(t.speed);
+  table.set(t.speed, t.weight, t.ratio, t.farnsworth);
+  return table;
+}
+
+
+// Silence from the end of the last mark of a character, and of a word, to the next mark,
+// in millis.
+long characterSilence(const KeyTiming &t) { return (t.space() + t.character()) / 1000; }
+long wordSilence(const KeyTiming &t) { return (t.space() + t.character() + t.word()) / 1000; }
+
+
+// Server mode - see if the playout timeline has gone quiet for a word space, either by
+// the sender's spacing or by our own clock, so it can be re-anchored.
+int timelineQuiet(long senderGap, long wordSpace) {
+  if (!streamAnchored) { return 1; }
+  if (!elements.isEmpty() || keyerState != keyerIdle) { return 0; }
+  if (!keyEdges.isEmpty() || straightDown) { return 0; }
+  if (!remoteText.isEmpty() || remoteSender.busy) { return 0; }
+
+  return senderGap > wordSpace || (long) (millis() - (streamSenderEnd + streamOffset)) > wordSpace;
+}
+
+
+// Server mode - take a transit sample for the playout delay, and for the stats.
+void addTransit(long transit) {
+  jitter.addTransit(transit);
+  stats.add(histTransit, transit - jitter.fastest());
+}
+
+
+// Server mode - take back some of a slip out of the silence before a run or key-down
+// that starts at sender time senderStart, so the timeline does not stay late for the
+// rest of the burst. Never below the space the silence stands for: a character space
+// keeps its 3 dits, and a word space its 7, or what the sender's timing makes of them.
+void takeBackSlip(unsigned long senderStart, long gap, const KeyTiming &shape) {
+  long debt = (long) (streamOffset - streamBase);
+  long character = characterSilence(shape);
+  long word = wordSilence(shape);
+  long keep = (gap >= (character + word) / 2) ? word : character;
+  long spare = gap - keep;
+  long ahead = (long) (senderStart + streamOffset - millis());
+  if (debt > 0 && spare > 0 && ahead > 0) { streamOffset -= min(debt, min(spare, ahead)); }
+}
+
+
+// Server mode - put a run of elements on the playout timeline, from the sender time the
+// first one started. A late run slips the timeline so it plays now, and keeps its spacing
+// to the ones after it; the slip is taken back later by takeBackSlip(). A run later than
+// latePlayoutLimit is dropped.
+void scheduleRun(unsigned long senderStart, const WireFrame &frame, const KeyTiming &shape) {
+
+  unsigned long now = millis();
+  unsigned long senderTime = senderStart;
+  uint32_t micro = 0;
+
+  takeBackSlip(senderStart, frame.gap, shape);
+  long late = (long) (now - (senderStart + streamOffset));
+  if (late > latePlayoutLimit) { playoutDrops++; }
+  else if (late > 0) { playoutSlips++; }
+  if (late <= latePlayoutLimit) { stats.add(histWait, -late); }
+
+  for (int x = 0; x < frame.length; x++) {
+    int sym = wireElementAt(frame, x) ? symDah : symDit;
+
+    unsigned long at = senderTime + streamOffset;
+    micro += (sym == symDit ? shape.dit() : shape.dah()) + shape.space();
+    senderTime += micro / 1000;
+    micro %= 1000;
+    if (late > latePlayoutLimit) { continue; }
+    if ((long) (at - now) < 0) {
+      streamOffset += now - at;
+      at = now;
+    }
+    PlayoutElement element = { at, sym, frame.timing };
+    elements.push(element);
   }
+  streamSenderEnd = senderTime + ((long) micro - (long) shape.space()) / 1000;
 }
 
 
-// Server mode - play a packet.
-void playPacket(DataPacket packet) {
+// Server mode - widen a 16 bit sender stamp around where the sender's clock should have
+// been when the frame arrived.
+unsigned long widenStamp(uint16_t stamp, unsigned long arrival) {
+  unsigned long expected = arrival - jitter.lastTransit();
+  return expected + (int16_t) (stamp - (uint16_t) expected);
+}
 
-  int spacing = (int)(packet.number >> 16);
-  DEBUG_PRINT("spacing: ");
-  DEBUG_PRINTLN(spacing);
-#ifdef DEBUG
-  uint16_t packetNumber = (uint16_t) (packet.number & 0xFFFF);
-#endif
-  uint16_t frameLength = (uint16_t) (packet.data >> 16);
-  uint16_t frame = (uint16_t) packet.data;
- 
-  int alreadyPassed = (int) (millis() - lastSymPlayedTime) - ditMillis;
-  DEBUG_PRINT("Packet recd: ");
-  DEBUG_PRINTLN(packetNumber);
-  DEBUG_PRINT("alreadypassed: ");
-  DEBUG_PRINTLN(alreadyPassed);
-  if (spacing > alreadyPassed) {
-    int waitTime = spacing - alreadyPassed - (ditMillis * 2);
-    if (waitTime > 10) { 
-      delay(waitTime); }
-      DEBUG_PRINT("waittime: ");
-      DEBUG_PRINTLN(waitTime);
-  }
-  for (int x = 0; x < frameLength; x++) {
-    unsigned int roll = (frame & 0xC000) >> 14;
-    frame = frame << 2;
-    delay(0);
-    playSym(roll, TX, NO_REC, 0);
-  }
-}
-
-
-// See what kind of packet came in, and queue as necessary.
-void parsePacket(DataPacket packet) {
-
-  uint16_t updPacketType = packet.data >> 30;
-  uint16_t frame = (uint16_t) packet.data;
-
-  switch (updPacketType) {
-    case udpKeepAlive:
-      ditMillis = frame;
-      sendPacket((udpAck << 30), 0);        
-      if (!packets.isEmpty()) { playNextPacket = 1; }
-      else playNextPacket = 0;
-      break;
-    case udpFrame:
-      packets.push(packet);
+
+// Server mode - schedule a run of elements. Once the client has synchronized its clock,
+// the frame carries the server time the run started. Before that, the timeline is rebuilt
+// from the gaps, and the first frame of a burst is taken as on time. Either way, the first
+// run of a burst takes the playout offset from the jitter buffer. The transit history
+// means nothing across a switch between the two, so start over. A frame recovered from a
+// later datagram arrived late by the sender's spacing, not the network, so it is not a
+// transit sample.
+void scheduleFrame(const WireFrame &frame, unsigned long arrival, int recovered) {
+
+  unsigned long senderStart;
+  KeyTiming shape = remoteTiming(frame.timing);
+
+  if (frame.stamped != streamStamped) {
+    streamStamped = frame.stamped;
+    streamAnchored = 0;
+    jitter.reset();
   }
+  int quiet = timelineQuiet(frame.gap, wordSilence(shape));
+
+  if (frame.stamped) {
+    senderStart = widenStamp(frame.stamp, arrival);
+    if (!recovered) { addTransit(arrival - senderStart); }
+  } else if (quiet) {
+    senderStart = arrival - jitter.fastest();
+  } else {
+    senderStart = streamSenderEnd + frame.gap;
+    if (!recovered) { addTransit(arrival - senderStart); }
+  }
+  if (quiet) {
+    streamOffset = jitter.offset();
+    streamBase = streamOffset;
+    streamAnchored = 1;
+  }
+  DEBUG_PRINT("playout delay: ");
+  DEBUG_PRINTLN(jitter.delay());
+  scheduleRun(senderStart, frame, shape);
 }
 
 
-// MAIN FUNCTIONS
+// Server mode - start the next element when it is due. A pending element may
+// cut the trailing space of the previous one short, never its mark.
+void playElements() {
 
-void loop() {
-  char frame[10];
+  keyerService();
+  if (elements.isEmpty() || keyerState == keyerMark) { return; }
+  if ((long) (millis() - elements.first().at) < 0) { return; }
 
-  int A0_switch = 0;
+  PlayoutElement element = elements.shift();
+  keyerAbort();
+  takeTiming(element.timing);
+  keyerStart(element.sym, playoutTransmit);
+}
 
-  int ditPressed = (digitalRead(pinKeyDit) == LOW);
-  int dahPressed = (digitalRead(pinKeyDah) == LOW);
-  delay(3);
-  ditPressed = ditPressed & (digitalRead(pinKeyDit) == LOW);
-  dahPressed = dahPressed & (digitalRead(pinKeyDah) == LOW);
 
-  // Server mode handling
-  if (netMode == netServer) {
-    int packetSize = udp.parsePacket();
-    if (packetSize) {
-      udp.read(frame, 10);
-      memcpy(&packet, frame, sizeof(packet));
-      parsePacket(packet);
+// Server mode - put a frame of key edges on the playout timeline. The spans give the
+// edges' timing to a tenth of a millisecond; once the client has synchronized its clock,
+// the stamp puts the first edge back in place if a lost frame has thrown the sum out.
+// Timeline anchoring and late edges are handled as for element runs.
+void scheduleEdges(const WireFrame &frame, unsigned long arrival, int recovered) {
+
+  if (!frame.length) { return; }
+  if (frame.stamped != streamStamped) {
+    streamStamped = frame.stamped;
+    streamAnchored = 0;
+    jitter.reset();
+  }
+  int quiet = timelineQuiet(frame.spans[0] * wireEdgeUnit / 1000, wordSilence(timing));
+
+  uint32_t micro = edgeSenderMicros + frame.spans[0] * wireEdgeUnit;
+  unsigned long sender = edgeSenderTime + micro / 1000;
+  micro %= 1000;
+  if (frame.stamped) {
+    unsigned long stamped = widenStamp(frame.stamp, arrival);
+    if (quiet || labs((long) (sender - stamped)) > 2) {
+      sender = stamped;
+      micro = 0;
     }
-    // if more than 2 packets queued, trigger playback.
-    if (packets.size() > 2) { playNextPacket = 1; }
-    if (playNextPacket && (!packets.isEmpty())) {
-      packet = packets.shift();
-      playPacket(packet);
+  } else if (quiet) {
+    sender = arrival - jitter.fastest();
+    micro = 0;
+  }
+  if (!recovered && (frame.stamped || !quiet)) { addTransit(arrival - sender); }
+  if (quiet) {
+    streamOffset = jitter.offset();
+    streamBase = streamOffset;
+    streamAnchored = 1;
+  } else if (frame.down) {
+    takeBackSlip(sender, frame.spans[0] * wireEdgeUnit / 1000, timing);
+  }
+
+  uint32_t now = micros();
+  int down = frame.down;
+  for (int i = 0; i < frame.length; i++) {
+    if (i) {
+      micro += frame.spans[i] * wireEdgeUnit;
+      sender += micro / 1000;
+      micro %= 1000;
     }
-  } else if (currState == stateIdle) {
-      A0_switch = readAnalog();
-
-      // Client mode keepalive
-      if (lastPacketSentTime && netMode == netClient) {
-        toSend  = 0;
-        keepAliveTimer = millis() - lastPacketSentTime;
-        if (keepAliveTimer > 1000 && (!ditPressed && !dahPressed) && !toChar) {
-          sendPacket((udpKeepAlive << 30) + ditMillis, 0);
-          lastPacketType = udpKeepAlive;
-          toSend = 0;
-          lastSymPlayedTime = millis();
-        }
-      }
+    uint32_t at = (uint32_t) ((sender + streamOffset) * 1000) + micro;
+    if ((int32_t) (at - now) < 0) {
+      streamOffset += ((now - at) + 999) / 1000;
+      at = (uint32_t) ((sender + streamOffset) * 1000) + micro;
+      if (!i) { playoutSlips++; }
+    }
+    if (!i) { stats.add(histWait, (int32_t) (at - now) / 1000); }
+    PlayoutEdge edge = { at, down };
+    keyEdges.push(edge);
+    down = !down;
+  }
+  edgeSenderTime = sender;
+  edgeSenderMicros = micro;
+  streamSenderEnd = sender;
+}
 
-      processPaddles(ditPressed, dahPressed, TX, NO_REC);
-
-    // Enter the speed set mode with a short press of the setup button
-    if (digitalRead(pinSetup) == LOW) {
-      unsigned long whenStartedPress = millis();
-      int nextState = stateSettingSpeed;      
-
-      delay(5);
-
-      while (digitalRead(pinSetup) == LOW) {
-        // 3 seconds to enter advanced configuration mode
-        if (millis() > whenStartedPress + 1000) {
-//          digitalWrite(pinStatusLed, HIGH);
-          nextState = stateSettingTone;
-          playStr("TONE", SPKR);
-        }
-        A0_switch = readAnalog();
-        // While in speed set mode we press Memory1, it changes to paddle keyer
-        if (A0_switch == 1) {
-          playChar('I', SPKR);
-          currKeyerMode = keyerModeIambic;
-          saveStorageEmptyPacket(packetTypeKeyerModeIambic);
-          waitPin(pinSetup, HIGH);
-          nextState = stateIdle;
-          break;
-        }
-        // While in speed set mode we press Memory2, it changes to straight key
-        if (A0_switch == 2) {
-          playChar('S', SPKR);
-          currKeyerMode = keyerModeStraight;
-          saveStorageEmptyPacket(packetTypeKeyerModeStraight);
-          waitPin(pinSetup, HIGH);
-          nextState = stateIdle;
-          break;
-        }
-        // While in speed set mode we press Memory3, it changes to Vibroplex
-        if (A0_switch == 3) {
-          playChar('V', SPKR);
-          currKeyerMode = keyerModeVibroplex;
-          saveStorageEmptyPacket(packetTypeKeyerModeVibroplex);
-          waitPin(pinSetup, HIGH);
-          nextState = stateIdle;
-          break;
-        }
-      }
 
-      digitalWrite(pinStatusLed, LOW);
-      currState = nextState;
-        
-      delay(50);
+// Server mode - hand key edges to the output scheduler just before they are due. A
+// key-down held longer than maxRemoteMark is let go, in case the key-up was lost.
+void playEdges() {
+
+  uint32_t now = micros();
+
+  while (!keyEdges.isEmpty() && (int32_t) (keyEdges.first().at - now) <= (int32_t) keyerLead) {
+    PlayoutEdge edge = keyEdges.shift();
+    keyerManual(edge.down, playoutTransmit, edge.at);
+    if (edge.down) { manualDownAt = edge.at; }
+  }
+  if (straightDown && keyEdges.isEmpty() && (int32_t) (now - manualDownAt) > (int32_t) (maxRemoteMark * 1000)) {
+    keyerManual(0, playoutTransmit, now);
+  }
+}
+
+
+// Server mode - put a frame of text on the playout timeline, from the sender time of its
+// first character, or when it came in for a client that has not synchronized its clock.
+// It is keyed after any text still to play. A late frame slips the timeline as a late
+// run does. A frame with no text cancels what is left.
+void scheduleText(const WireFrame &frame, unsigned long arrival, int recovered) {
+
+  if (!frame.length) {
+    remoteText.clear();
+    senderStop(remoteSender);
+    remoteProsign = 0;
+    return;
+  }
+  if (frame.stamped != streamStamped) {
+    streamStamped = frame.stamped;
+    streamAnchored = 0;
+    jitter.reset();
+  }
+  int quiet = timelineQuiet(0, wordSilence(remoteTiming(frame.timing)));
+
+  unsigned long sender = frame.stamped ? widenStamp(frame.stamp, arrival) : arrival - jitter.fastest();
+  if (!recovered && frame.stamped) { addTransit(arrival - sender); }
+  if (quiet) {
+    streamOffset = jitter.offset();
+    streamBase = streamOffset;
+    streamAnchored = 1;
+  }
+
+  unsigned long now = millis();
+  unsigned long at = sender + streamOffset;
+  long late = (long) (now - at);
+  if (late > latePlayoutLimit) {
+    playoutDrops++;
+    return;
+  }
+  if (late > 0) {
+    playoutSlips++;
+    streamOffset += late;
+    at = now;
+  }
+  stats.add(histWait, -late);
+  for (int i = 0; i < frame.length; i++) {
+    if (remoteText.isFull()) {
+      playoutDrops++;
+      break;
     }
+    PlayoutChar c = { at, frame.timing, frame.text[i], (uint8_t) (i == 0) };
+    remoteText.push(c);
+  }
+  streamSenderEnd = sender;
+}
 
-    checkMemoryPin(0, 1, 0);
-    checkMemoryPin(1, 2, 0);
-    checkMemoryPin(2, 3, 0);
-  } else if (currState == stateSettingSpeed) {
-    if (playSymInterruptable(symDit, 0, pinSetup, LOW) != -1) {
-      currState = stateIdle;
-      saveStorageInt(packetTypeSpeed, ditMillis);      
-      waitPin(pinSetup, HIGH);
-      return;
+
+// Server mode - key the remote text a character at a time, as the sender comes free.
+// Letters between < and > are run together.
+void playText() {
+  if (!senderService(remoteSender) || remoteText.isEmpty()) { return; }
+
+  PlayoutChar next = remoteText.shift();
+  takeTiming(next.timing);
+  if (next.first) {
+    uint32_t start = micros() + (long) (next.at - millis()) * 1000;
+    if ((int32_t) (start - remoteSender.at) > 0) { remoteSender.at = start; }
+  }
+
+  if (senderText(remoteSender, next.c, remoteProsign, remoteMerge)) { senderService(remoteSender); }
+}
+
+
+// Server mode - elements, edges and characters waiting to play.
+int playoutDepth() {
+  return elements.size() + keyEdges.size() + remoteText.size();
+}
+
+
+// ECHO
+// The server reports the marks it keys on the rig back to the client, so the client
+// knows what was actually keyed, and when.
+
+// Server mode - send the marks keyed so far, with how far the playout is behind.
+void echoSend() {
+  long behind = (long) (streamOffset - streamBase);
+  echoFrame.depth = playoutDepth();
+  echoFrame.behind = behind > 0 ? min(behind, (long) UINT16_MAX) : 0;   // Held to the 16 bits of the field
+  sendFrame(echoFrame);
+  wireClear(echoFrame, wireEcho);
+}
+
+
+// Server mode - note an edge keyed on the rig. The sender time of a key-down is its
+// time here less the playout offset, and the mark goes in the echo at its key-up. The
+// edges are queued ahead of time, so the echo waits for echoService() to see it end.
+void echoKeyed(uint32_t at, int down) {
+  if (down) {
+    echoSender = millisAt(at) - streamOffset;
+    echoDownAt = at;
+    return;
+  }
+  if (echoFrame.type != wireEcho) { wireClear(echoFrame, wireEcho); }
+  if (echoFrame.length == wireMaxEchoes) { echoSend(); }
+
+  WireEcho &echo = echoFrame.echoes[echoFrame.length++];
+  echo.sender = echoSender;
+  echo.lag = streamOffset < 0xFFFF ? streamOffset : 0xFFFF;
+  echo.mark = (at - echoDownAt) / wireEdgeUnit;
+  echoUpAt = at;
+}
+
+
+// Server mode - send the echo once the last mark in it has ended.
+void echoService() {
+  if (!outgoing.isEmpty()) { return; }
+  if (echoFrame.type == wireEcho && echoFrame.length && (int32_t) (micros() - echoUpAt) >= 0) { echoSend(); }
+}
+
+
+// Client mode - the server's report of the marks it keyed. Each is matched by the sender
+// time of its key-down to the mark keyed here, once the clock is synchronized, for the
+// round trip from the key-down to the report, less the mark. Marks here with no echo
+// are passed over.
+void echoReceive(const WireFrame &frame, unsigned long arrival) {
+  stats.set(statServerBehind, frame.behind);
+  if (!serverBehind && frame.behind > echoWarnBehind) {
+    serverBehind = 1;
+    if (serialText) {
+      Serial.print("Server behind by ");
+      Serial.print(frame.behind);
+      Serial.println(" ms");
     }
-    while (ditPressed || dahPressed) {
-      if (ditPressed) { ditMillis = scaleDown(ditMillis, 1/1.05, 20); }
-      if (dahPressed) { ditMillis = scaleUp(ditMillis, 1.05, 800); }
-      int ret = playSpeed(); 
-      switch (ret) {
-        case pinKeyDit:  
-          ditPressed = true;
-          break;
-        case pinKeyDah:
-          dahPressed = true;
-          break;
-        default:
-          ditPressed = false;
-          dahPressed = false;
+  } else if (serverBehind && frame.behind < echoWarnBehind / 2) {
+    serverBehind = 0;
+    if (serialText) { Serial.println("Server caught up"); }
+  }
+  if (!clockSync.synced()) { return; }
+
+  uint32_t serverNow = clockSync.toServer(arrival);
+  for (int i = 0; i < frame.length; i++) {
+    const WireEcho &echo = frame.echoes[i];
+    unsigned long sender = serverNow + (int16_t) (echo.sender - (uint16_t) serverNow);
+    stats.set(statKeyingLag, echo.lag);
+
+    while (!sentMarks.isEmpty()) {
+      SentMark sent = sentMarks.first();
+      long early = (long) (sender - clockSync.toServer(sent.down));
+      if (early > (long) timing.ditMillis() / 2) {
+        sentMarks.shift();
+        continue;
+      }
+      if (early >= -(long) timing.ditMillis() / 2) {
+        sentMarks.shift();
+        long keyed = echo.mark * wireEdgeUnit;
+        long error = keyed - (long) sent.mark;
+        stats.add(histEcho, (long) (arrival - sent.down) - keyed / 1000);
+        stats.add(histMarkError, labs(error) / wireEdgeUnit);
+        DEBUG_PRINT("echo: mark error us ");
+        DEBUG_PRINT(error);
+        DEBUG_PRINT(" lag ");
+        DEBUG_PRINTLN(echo.lag);
       }
+      break;
     }
-  } else if (currState == stateSettingTone) {
-    if (playSymInterruptable(symDit, 0, pinSetup, LOW) != -1) {
-      currState = stateIdle;
-      waitPin(pinSetup, HIGH);
-      return;
+  }
+}
+
+
+// See what kind of frame came in, and queue as necessary.
+void handleFrame(const WireFrame &frame, unsigned long arrival, int recovered) {
+
+  switch (frame.type) {
+    case wireKeepAlive:
+      takeTiming(frame.timing);
+      if (!recovered) { sendAck(frame.t1, arrival); }                   // A copy's times are stale
+      break;
+    case wireAck:
+      if (recovered) { break; }
+      clockSync.addSample(frame.t1, frame.t2, frame.t3, arrival);
+      stats.add(histRoundTrip, (long) (arrival - frame.t1) - (long) (frame.t3 - frame.t2));
+      break;
+    case wireElement:
+    case wireChar:
+      scheduleFrame(frame, arrival, recovered);
+      break;
+    case wireEdge:
+      scheduleEdges(frame, arrival, recovered);
+      break;
+    case wireText:
+      scheduleText(frame, arrival, recovered);
+      break;
+    case wireEcho:
+      if (!recovered) { echoReceive(frame, arrival); }
+  }
+}
+
+
+// Hand on the frames the receive window has ready, in sequence order.
+void deliverFrames() {
+  ReceivedFrame received;
+
+  while (peerFrames.next(received, millis(), reorderWait + fecRepeat * fecRepeats)) {
+    if (received.recovered) { stats.count(statRecovered); }
+    handleFrame(received.frame, received.arrival, received.recovered);
+    stats.peak(statQueuePeak, playoutDepth());
+  }
+}
+
+
+// Unpack a datagram: the frame, then any earlier copies carried for error correction.
+// All of them go through the receive window, copies first, oldest first; the window
+// drops the ones already received.
+void parsePacket(const char *data, int size, unsigned long arrival) {
+
+  const uint8_t *buf = (const uint8_t *) data;
+  WireFrame frames[1 + wireMaxRedundancy];
+  int count = 0;
+
+  if (size <= 0) { return; }
+  size_t pos = wireDecode(buf, size, frames[0]);
+  if (!pos) { return; }
+  count++;
+
+  // A peer that has booted numbers its frames from 1 again, which the window would
+  // take for late ones. A new session starts the window over instead.
+  if (frames[0].session != peerSession) {
+    peerFrames.reset();
+    peerSession = frames[0].session;
+  }
+
+  while (count <= wireMaxRedundancy && pos < (size_t) size) {
+    uint32_t length;
+    size_t start = wireGetVarint(buf, pos, size, length);
+    if (!start || start + length > (size_t) size) { break; }
+    if (!wireDecode(buf + start, length, frames[count])) { break; }
+    count++;
+    pos = start + length;
+  }
+
+  int first = (frames[0].type == wireRepeat) ? 1 : 0;                   // A repeat is only copies
+  for (int i = count - 1; i >= first; i--) {
+    ReceivedFrame received = { frames[i], arrival, i > 0 };
+    if (peerFrames.offer(frames[i].sequence, received, arrival)) { deliverFrames(); }
+  }
+}
+
+
+// Read the datagrams that have come in, up to receiveBatch, and pass on any held frames
+// whose wait is up. Playout runs from its own queues, so reading never waits on keying.
+void receivePacket() {
+  char frame[wireMaxDatagram];
+
+  if (linkState != linkUp) { return; }
+  for (int i = 0; i < receiveBatch && udp.parsePacket(); i++) {
+    unsigned long received = millis();
+    int size = udp.read(frame, sizeof(frame));
+    if (!monitorOffer((const uint8_t *) frame, size)) { parsePacket(frame, size, received); }
+  }
+  deliverFrames();
+}
+
+
+// MONITOR FAN-OUT
+// The server sends on the datagrams it keys to its monitor listeners (see Monitor.h). A
+// server set up as a listener subscribes to the one it listens to instead.
+
+// Open the UDP port once the link is up, joining the monitor group if this is a listener
+// and there is one. The server keeps the group as a listener for good. Returns 0 if the
+// port will not open.
+int monitorBegin() {
+  IPAddress group;
+  int grouped = monitorGroup[0] && group.fromString(monitorGroup);
+
+  if (netMode == netServer && monitorHost[0] && grouped) { return udp.beginMulticast(WiFi.localIP(), group, port); }
+  if (netMode == netServer && !monitorHost[0] && grouped) { monitor.subscribe(group, port, millis(), true); }
+  return udp.begin(port);
+}
+
+
+// Server mode - take a subscribe, or queue a datagram of key timing for the listeners.
+// Returns 1 if the datagram was a subscribe, which is not for the receive window.
+int monitorOffer(const uint8_t *data, int size) {
+  if (size <= 0 || (data[0] >> 5) != wireVersion) { return 0; }
+
+  uint8_t type = data[0] & 0x0F;
+  if (type == wireSubscribe) {
+    if (!monitorHost[0]) { monitor.subscribe(udp.remoteIP(), udp.remotePort(), millis()); }
+    return 1;
+  }
+  if (!monitorHost[0] && (type == wireChar || type == wireElement || type == wireEdge || type == wireText
+    || type == wireRepeat)) {
+    monitor.queue(data, size);
+  }
+  return 0;
+}
+
+
+// Server mode - send one queued datagram to one listener, so the key line never waits on
+// more than a single send, and only once the datagrams to the peer are out. A listener subscribes again every monitorRefresh millis.
+void monitorService() {
+  const uint8_t *data;
+  size_t size;
+  const MonitorListener *to;
+
+  if (linkState != linkUp || !outgoing.isEmpty()) { return; }
+  if (monitorHost[0]) {
+    if (monitorGroup[0] || (subscribedAt && millis() - subscribedAt < monitorRefresh)) { return; }
+    subscribedAt = millis();
+    WireFrame frame;
+    uint8_t buffer[wireMaxSize];
+    wireClear(frame, wireSubscribe);
+    frame.session = session;
+    size = wireEncode(frame, buffer, sizeof(buffer));
+    udp.beginPacket(monitorHost, port);
+    udp.write(buffer, size);
+    udp.endPacket();
+    return;
+  }
+
+  monitor.expire(millis(), monitorTimeout);
+  if (!monitor.next(data, size, to)) { return; }
+  if (to->group) { udp.beginPacketMulticast(to->ip, to->port, WiFi.localIP()); }
+  else { udp.beginPacket(to->ip, to->port); }
+  udp.write(data, size);
+  udp.endPacket();
+  monitor.sent();
+}
+
+
+// Send the stats to the collector, every statsInterval millis, when there is one.
+void statsService() {
+  if (!statsHost[0] || linkState != linkUp || millis() - statsSentAt < statsInterval) { return; }
+  statsSentAt = millis();
+
+  stats.set(statFramesReceived, peerFrames.received);
+  stats.set(statDuplicates, peerFrames.duplicates);
+  stats.set(statLate, peerFrames.late);
+  stats.set(statLost, peerFrames.lost);
+  stats.set(statReordered, peerFrames.reordered);
+  stats.set(statSlips, playoutSlips);
+  stats.set(statDrops, playoutDrops);
+  stats.set(statPlayoutDelay, jitter.delay());
+  stats.set(statJitter, jitter.jitter());
+  stats.set(statRoundTrip, clockSync.roundTrip());
+  stats.set(statQueueDepth, playoutDepth());
+  stats.set(statPaddleDrops, paddleEdges.drops());
+  stats.set(statListeners, monitor.listening());
+  stats.set(statMonitorDrops, monitor.drops());
+  stats.set(statSendDrops, outgoing.drops);
+
+  uint8_t buffer[statsMaxSize];
+  size_t size = stats.encode(buffer, sizeof(buffer), netMode, millis());
+  if (!size) { return; }
+  udp.beginPacket(statsHost, statsPort);
+  udp.write((const char *) buffer, size);
+  udp.endPacket();
+}
+
+
+// MAIN FUNCTIONS
+
+void loop() {
+  int ditPressed, dahPressed;
+  paddleRead(&ditPressed, &dahPressed);
+  settingsService();
+  networkService();
+  udpService();
+  repeatService();
+  statsService();
+  beepService();
+  if (currState == stateIdle) {
+#ifdef WINKEYER
+    hostService(ditPressed, dahPressed);
+#endif
+    memoryService(ditPressed, dahPressed);
+  }
+  if (currState == stateSettingSpeed || currState == stateSettingTone || currState == stateSettingPage) { announceService(0, 0); }
+  else { announceService(ditPressed, dahPressed); }
+
+  // Server mode handling
+  if (netMode == netServer) {
+    receivePacket();
+    playElements();
+    playEdges();
+    playText();
+    echoService();
+    monitorService();
+  } else if (currState == stateIdle) {
+    // Client mode keepalive, and clock sync from the acks
+    if (netMode == netClient) {
+      receivePacket();
+      keepAliveTimer = millis() - lastPacketSentTime;
+      if (keepAliveTimer > 1000 && (!ditPressed && !dahPressed) && !toSend.length && keyerState == keyerIdle && outgoing.isEmpty()) {
+        sendKeepAlive();
+        lastPacketType = wireKeepAlive;
+        lastSymPlayedTime = millis();
+      }
     }
-    if (ditPressed) { toneFreq = scaleDown(toneFreq, 1/1.1, 30); }
-    if (dahPressed) { toneFreq = scaleUp(toneFreq, 1.1, 12500); }
-    saveStorageInt(packetTypeFreq, toneFreq);
+
+    processPaddles(ditPressed, dahPressed, TX);
+    setupService();
+    memoryButtonService();
+  } else if (currState == stateRecording) {
+    recordService(ditPressed, dahPressed);
+  } else if (currState == stateSettingSpeed) {
+    speedService(ditPressed, dahPressed);
+  } else if (currState == stateSettingTone) {
+    toneService(ditPressed, dahPressed);
+  } else if (currState == stateSettingPage) {
+    pageService(ditPressed, dahPressed);
   }
 }
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+# Link telemetry collector.
+#
+# Listens for the stats datagrams both keyers send when statsHost in
+# include/Network.h is set to this machine (see include/Telemetry.h for the
+# format), and prints a line per datagram: the counters as rates over the
+# interval since the last one from the same keyer, the readings as they are,
+# and the median and 95th percentile of each histogram over the interval (as
+# the lower edge of the bin they fall in, in millis).
+# With --csv, every datagram is also appended to a file, one row per keyer
+# per interval, for plotting.
+#
+# Usage: stats.py [--port 4121] [--csv stats.csv]
+
+import argparse
+import csv
+import socket
+import time
+
+STATS_MAGIC = 0x53
+STATS_VERSION = 1
+
+COUNTERS = [
+    "sent", "received", "duplicates", "late", "lost", "reordered", "recovered",
+    "slips", "drops", "playout_ms", "jitter_ms", "rtt_ms", "queue", "queue_peak",
+    "paddle_drops", "listeners", "monitor_drops", "lag_ms", "behind_ms", "send_drops",
+]
+READINGS = {"playout_ms", "jitter_ms", "rtt_ms", "queue", "queue_peak", "listeners", "lag_ms", "behind_ms"}
+HISTOGRAMS = ["rtt", "transit", "wait", "echo", "mark_err"]
+HISTOGRAM_MS = {"mark_err": 0.1}                                  # Millis a bin unit is, when not 1
+ROLES = {1: "client", 2: "server"}
+
+
+def varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return value, pos
+        shift += 7
+
+
+def decode(data):
+    if len(data) < 3 or data[0] != STATS_MAGIC or data[1] != STATS_VERSION:
+        return None
+    role = data[2]
+    uptime, pos = varint(data, 3)
+    count, pos = varint(data, pos)
+    counters = []
+    for _ in range(count):
+        value, pos = varint(data, pos)
+        counters.append(value)
+    count, pos = varint(data, pos)
+    histograms = []
+    for _ in range(count):
+        bins, pos = varint(data, pos)
+        values = []
+        for _ in range(bins):
+            value, pos = varint(data, pos)
+            values.append(value)
+        histograms.append(values)
+    return role, uptime, counters, histograms
+
+
+def bin_range(b):
+    # Millis a histogram bin starts at: 0, 1, 2, 4, ...
+    return 0 if b == 0 else 1 << (b - 1)
+
+
+def percentile(bins, p):
+    total = sum(bins)
+    if not total:
+        return None
+    need = total * p / 100.0
+    seen = 0
+    for b, n in enumerate(bins):
+        seen += n
+        if seen >= need:
+            return bin_range(b)
+    return bin_range(len(bins) - 1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Collect keyer link telemetry.")
+    parser.add_argument("--port", type=int, default=4121)
+    parser.add_argument("--csv", help="append every interval to this file")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("", args.port))
+    writer = None
+    if args.csv:
+        out = open(args.csv, "a", newline="")
+        writer = csv.writer(out)
+        if out.tell() == 0:
+            writer.writerow(["time", "keyer", "role", "uptime_ms"] + COUNTERS
+                            + ["%s_p%d" % (h, p) for h in HISTOGRAMS for p in (50, 95)])
+
+    last = {}
+    while True:
+        data, addr = sock.recvfrom(1024)
+        try:
+            stats = decode(data)
+        except IndexError:
+            stats = None
+        if not stats:
+            continue
+        role, uptime, counters, histograms = stats
+        key = (addr[0], role)
+        before = last.get(key)
+        if before and before[0] > uptime:                        # Rebooted
+            before = None
+        last[key] = (uptime, counters, histograms)
+
+        seconds = (uptime - before[0]) / 1000.0 if before else uptime / 1000.0
+        row = []
+        parts = []
+        for i, value in enumerate(counters):
+            name = COUNTERS[i] if i < len(COUNTERS) else "counter%d" % i
+            if name in READINGS:
+                row.append(value)
+                parts.append("%s %d" % (name, value))
+            else:
+                delta = value - before[1][i] if before else value
+                row.append(delta)
+                if delta:
+                    parts.append("%s %.1f/s" % (name, delta / seconds if seconds else 0))
+        for h, bins in enumerate(histograms):
+            if before:
+                bins = [n - m for n, m in zip(bins, before[2][h])]
+            name = HISTOGRAMS[h] if h < len(HISTOGRAMS) else "hist%d" % h
+            unit = HISTOGRAM_MS.get(name, 1)
+            p50 = percentile(bins, 50)
+            p95 = percentile(bins, 95)
+            if p50 is not None:
+                p50 *= unit
+                p95 *= unit
+                parts.append("%s p50 %g p95 %g ms" % (name, p50, p95))
+            row += [p50, p95]
+
+        print("%s %s %-6s up %ds: %s" % (time.strftime("%H:%M:%S"), addr[0], ROLES.get(role, role),
+                                         uptime // 1000, ", ".join(parts)))
+        if writer:
+            writer.writerow([int(time.time()), addr[0], ROLES.get(role, role), uptime] + row)
+            out.flush()
+
+
+if __name__ == "__main__":
+    main()